@@ -18,6 +18,11 @@ typedef struct sToken Token;
 typedef struct sObj Obj;
 typedef struct sNode Node;
 typedef struct sRelocation Relocation;
+typedef struct sArena Arena;
+typedef struct sArenaChunk ArenaChunk;
+typedef struct sIRInsn IRInsn;
+typedef struct sBasicBlock BasicBlock;
+typedef struct sIRFunc IRFunc;
 
 //
 // tokenize.c
@@ -31,6 +36,78 @@ typedef struct sRelocation Relocation;
 #define TK_EOF     4 // End-of-file markers
 #define TK_STR     5 // String literals
 
+// Keyword IDs
+//
+// Keywords that can start a declaration come first, so that is_typename()
+// can recognise all of them with a single comparison against KW_NORETURN.
+#define KW_NONE          0 // Not a keyword
+#define KW_BOOL          1 // _Bool
+#define KW_CHAR          2 // char
+#define KW_SHORT         3 // short
+#define KW_INT           4 // int
+#define KW_LONG          5 // long
+#define KW_STRUCT        6 // struct
+#define KW_UNION         7 // union
+#define KW_VOID          8 // void
+#define KW_TYPEDEF       9 // typedef
+#define KW_ENUM         10 // enum
+#define KW_STATIC       11 // static
+#define KW_EXTERN       12 // extern
+#define KW_SIGNED       13 // signed
+#define KW_UNSIGNED     14 // unsigned
+#define KW_CONST        15 // const
+#define KW_VOLATILE     16 // volatile
+#define KW_AUTO         17 // auto
+#define KW_REGISTER     18 // register
+#define KW_RESTRICT     19 // restrict
+#define KW___RESTRICT   20 // __restrict
+#define KW___RESTRICT__ 21 // __restrict__
+#define KW_NORETURN     22 // _Noreturn
+#define KW_RETURN       23 // return
+#define KW_IF           24 // if
+#define KW_ELSE         25 // else
+#define KW_FOR          26 // for
+#define KW_WHILE        27 // while
+#define KW_SIZEOF       28 // sizeof
+#define KW_TEST_ASSERT  29 // _TEST_ASSERT
+#define KW_GOTO         30 // goto
+#define KW_BREAK        31 // break
+#define KW_CONTINUE     32 // continue
+#define KW_SWITCH       33 // switch
+#define KW_CASE         34 // case
+#define KW_DEFAULT      35 // default
+#define KW_ALIGNOF      36 // _Alignof
+#define KW_DO           37 // do
+#define KW_COUNT        38 // Number of keyword IDs
+
+// Punctuator codes
+//
+// A single-character punctuator uses its own character as its code, eg '+'.
+// Multi-character punctuators are numbered from 128 upwards.
+#define PU_NONE          0 // Not a punctuator
+#define PU_EQ          128 // ==
+#define PU_NE          129 // !=
+#define PU_LE          130 // <=
+#define PU_GE          131 // >=
+#define PU_ARROW       132 // ->
+#define PU_ADD_ASSIGN  133 // +=
+#define PU_SUB_ASSIGN  134 // -=
+#define PU_MUL_ASSIGN  135 // *=
+#define PU_DIV_ASSIGN  136 // /=
+#define PU_MOD_ASSIGN  137 // %=
+#define PU_AND_ASSIGN  138 // &=
+#define PU_OR_ASSIGN   139 // |=
+#define PU_XOR_ASSIGN  140 // ^=
+#define PU_INC         141 // ++
+#define PU_DEC         142 // --
+#define PU_LOGAND      143 // &&
+#define PU_LOGOR       144 // ||
+#define PU_SHL         145 // <<
+#define PU_SHR         146 // >>
+#define PU_SHL_ASSIGN  147 // <<=
+#define PU_SHR_ASSIGN  148 // >>=
+#define PU_COUNT       149 // Number of punctuator codes
+
 // Token type
 struct sToken {
 	int kind;           // Token kind
@@ -40,6 +117,9 @@ struct sToken {
 	int len;            // Token length
 	Type *ty;           // Used if TK_NUM or TK_STR
 	char *str;          // String literal contents including terminator
+	int keyword;        // If kind is TK_KEYWORD, its keyword ID
+	int punct;          // If kind is TK_PUNCT, its punctuator code
+	char *ident;        // If kind is TK_IDENT, its interned name
 
 	int line_no;        // Line number
 };
@@ -47,11 +127,18 @@ struct sToken {
 void error(char *fmt);
 void error_at(char *loc, char *fmt);
 void error_tok(Token *tok, char *fmt);
+void warn_at(char *loc, char *fmt);
+int loc_line(char *loc);
+int loc_column(char *loc);
 int equal(Token *tok, char *op);
 long get_number(Token *tok);
 Token *skip(Token *tok, char *op);
 int consume(Token **rest, Token *tok, char *str);
 Token *tokenize_file(char *filename);
+void initialize_keywords(void);
+void initialize_puncts(void);
+void initialize_idents(void);
+char *intern(char *p, int len);
 
 //
 // type.c
@@ -101,6 +188,12 @@ struct sType {
 	Type *return_ty;
 	Type *params;
 	Type *next;
+
+	// Derived types are interned on their base type, so that there is only
+	// one "pointer to T" and one "array of N T" for each T.
+	Type *pointer_cache; // Pointer to this type
+	Type *array_cache;   // First array of this type
+	Type *array_next;    // Next array type with the same base
 };
 
 extern Type *ty_void;
@@ -159,6 +252,7 @@ struct sObj {
 	// Global variable
 	char *init_data;
 	Relocation *rel;
+	char *reloc_targets; // Offsets that relocations with an addend point at
 
 	// Function
 	Obj *params;
@@ -175,6 +269,7 @@ struct sRelocation {
 	Obj *var;
 	int addend;
 	int id;
+	int at_run_time; // Applied by main() rather than resolved by hex2
 };
 
 // AST node
@@ -270,6 +365,7 @@ struct sNode {
 };
 
 Node *new_cast(Node *expr, Type *ty);
+int32_t eval(Node *node);
 Obj *parse(Token *tok);
 
 //
@@ -278,12 +374,100 @@ Obj *parse(Token *tok);
 
 void add_type(Node *node);
 
+//
+// ir.c
+//
+
+// IR opcodes. Binary operations take the immediate `imm` as their second
+// operand if `b` is 0.
+#define IR_IMM     0 // dst = imm
+#define IR_MOV     1 // dst = a
+#define IR_ADDR    2 // dst = &var + imm
+#define IR_LOAD    3 // dst = *(var or a + imm)
+#define IR_STORE   4 // *(var or a + imm) = b
+#define IR_COPY    5 // Copy imm bytes from address b to address a
+#define IR_ZERO    6 // Zero-clear the local var
+#define IR_ADD     7 // dst = a + b
+#define IR_SUB     8 // dst = a - b
+#define IR_MUL     9 // dst = a * b
+#define IR_DIV    10 // dst = a / b
+#define IR_MOD    11 // dst = a % b
+#define IR_AND    12 // dst = a & b
+#define IR_OR     13 // dst = a | b
+#define IR_XOR    14 // dst = a ^ b
+#define IR_SHL    15 // dst = a << b
+#define IR_SHR    16 // dst = a >> b
+#define IR_CMP    17 // dst = a cond b
+#define IR_NEG    18 // dst = -a
+#define IR_NOT    19 // dst = ~a
+#define IR_CAST   20 // dst = a truncated and extended to type id imm
+#define IR_ARG    21 // Push a as an argument
+#define IR_CALL   22 // dst = name(), imm arguments
+#define IR_JMP    23 // Jump to succs[0]
+#define IR_BR     24 // If a cond b jump to succs[0], otherwise to succs[1]
+#define IR_SWITCH 25 // Jump to the case of node matching a
+#define IR_RET    26 // Return a
+#define IR_NOP    27 // Removed instruction
+
+// IR instruction. Virtual registers are numbered from 1; 0 means none.
+struct sIRInsn {
+	IRInsn *next;
+	int op;
+	int dst;
+	int a;
+	int b;
+	int32_t imm;
+	int cond;        // ND_EQ, ND_NE, ND_LT or ND_LE
+	int is_unsigned;
+	Obj *var;        // Variable addressed by IR_ADDR, IR_LOAD, IR_STORE or IR_ZERO
+	Type *ty;        // Type loaded, stored or returned
+	char *name;      // Function called
+	Node *node;      // Switch statement
+	int pos;         // Position in the function, set by the emitter
+};
+
+// Basic block. The last instruction of a block is its only jump.
+struct sBasicBlock {
+	BasicBlock *next; // Next block in layout order
+	char *label;
+	IRInsn *insns;
+	IRInsn *last;
+	BasicBlock **succs;
+	int nsuccs;
+	int start;        // Position of the first and last instruction,
+	int end;          // set by the emitter
+};
+
+struct sIRFunc {
+	Obj *fn;
+	BasicBlock *blocks;
+	int nvregs;
+};
+
+IRFunc *lower_function(Obj *fn);
+
+//
+// fold.c
+//
+
+void fold_constants(Obj *prog);
+
 //
 // codegen.c
 //
 
 void codegen(Obj *prog, FILE *out);
 int align_to(int n, int align);
+int count(void);
+char *label_name(char *prefix, char *suffix);
+int cast_narrowing(Type *from, Type *to);
+
+//
+// peephole.c
+//
+
+void peephole_add(char *text);
+void peephole_flush(FILE *out);
 
 //
 // util.c
@@ -295,9 +479,36 @@ int isagraph(char c);
 int isaalpha(char c);
 int isapunct(char c);
 int startswith(char *p, char *q);
-char *string_slice(char *original, char *end);
 char ctolower(char c);
-char *stolower(char *s);
 char *uint2str(int i);
 void str_postfix(char *str, char *second);
 void num_postfix(char *str, int c);
+
+// Arena allocator
+struct sArenaChunk {
+	ArenaChunk *next;
+	char *buf;
+	int used;
+	int cap;
+};
+
+struct sArena {
+	ArenaChunk *head; // First chunk
+	ArenaChunk *cur;  // Chunk currently being allocated from
+};
+
+extern Arena *token_arena;   // Tokens and identifiers; lives until exit
+extern Arena *ast_arena;     // AST, types, objects and scopes; lives until exit
+extern Arena *scratch_arena; // Lookahead; reset after each top-level declaration
+
+void initialize_arenas(void);
+void *arena_alloc(Arena *arena, int size);
+void arena_reset(Arena *arena);
+
+//
+// main.c
+//
+
+extern int opt_ffold;
+extern int opt_fir;
+extern int opt_fpeephole;
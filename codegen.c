@@ -6,11 +6,46 @@ Obj *functions;
 int reloc_id = 0;
 Relocation *relocations;
 
+// While a function is being emitted, its lines are collected for the
+// peephole pass instead of being written out directly.
+int buffering;
+char *line_buf;
+int line_len;
+
 // Output functions
+void out_char(int c) {
+	if (!buffering) {
+		fputc(c, output_file);
+		return;
+	}
+	if (c == '\n') {
+		line_buf[line_len] = '\0';
+		peephole_add(line_buf);
+		line_len = 0;
+		return;
+	}
+	if (line_len >= MAX_STRING - 1) {
+		error("output line too long");
+	}
+	line_buf[line_len] = c;
+	line_len += 1;
+}
+
+void out_str(char *str) {
+	if (!buffering) {
+		fputs(str, output_file);
+		return;
+	}
+	while (str[0] != '\0') {
+		out_char(str[0]);
+		str += 1;
+	}
+}
+
 void str_postfix(char *str, char *second) {
-	fputs(str, output_file);
-	fputs(second, output_file);
-	fputc('\n', output_file);
+	out_str(str);
+	out_str(second);
+	out_char('\n');
 }
 
 void num_postfix(char *str, int c) {
@@ -18,12 +53,24 @@ void num_postfix(char *str, int c) {
 }
 
 void emit(char *str) {
-	fputs(str, output_file);
-	fputc('\n', output_file);
+	out_str(str);
+	out_char('\n');
 }
 
 int infile_id = 0;
 
+// Jump table for a dense switch statement, emitted after the code.
+struct JumpTable {
+	struct JumpTable *next;
+	int id;
+	Node **cases;  // Cases sorted by value
+	int ncases;
+	char *default_label;
+};
+typedef struct JumpTable JumpTable;
+
+JumpTable *jump_tables;
+
 int depth;
 Obj *codegening_fn;
 
@@ -58,6 +105,29 @@ void expand_stack(int size) {
 	num_postfix("sub_esp, %", size);
 }
 
+// Emit the name of a global variable or function, prefixed with the
+// file id if it is static.
+void emit_symbol(char *prefix, Obj *var) {
+	out_str(prefix);
+	if (var->is_static) {
+		out_str(uint2str(infile_id));
+		out_str("_");
+	}
+	out_str(var->name);
+}
+
+// Load the address of a global variable or function into a register.
+void emit_global_addr(char *reg, Obj *var) {
+	out_str("mov_");
+	out_str(reg);
+	if (var->is_function) {
+		emit_symbol(", &FUNCTION_", var);
+	} else {
+		emit_symbol(", &GLOBAL_", var);
+	}
+	out_char('\n');
+}
+
 // Round up `n` to the nearest multiple of `align.`
 int align_to(int n, int align) {
 	return (n + align - 1) / align * align;
@@ -67,19 +137,13 @@ int align_to(int n, int align) {
 // TODO: Fix M2-Planet not liking apostrophes in comments..
 // It is an error if the given node does not reside in memory.
 void gen_addr(Node *node) {
-	if (node->kind == ND_VAR || node->kind == ND_MEMZERO) {
+	if (node->kind == ND_VAR) {
 		if (node->var->is_local) {
 			// Local variable
 			str_postfix("lea_eax,[ebp+DWORD] %", int2str(node->var->offset, 10, TRUE));
 		} else {
 			// Global variable
-			fputs("mov_eax, &GLOBAL_", output_file);
-			if (node->var->is_static) {
-				fputs(uint2str(infile_id), output_file);
-				fputs("_", output_file);
-			}
-			fputs(node->var->name, output_file);
-			fputc('\n', output_file);
+			emit_global_addr("eax", node->var);
 		}
 	} else if (node->kind == ND_DEREF) {
 		gen_expr(node->lhs);
@@ -133,29 +197,61 @@ void mov_with_size(Type *ty) {
 	}
 }
 
-// Store %eax to the address in the top of the stack.
-void store(Type *ty) {
-	pop("ebx");
+// Structs and unions up to this many bytes are copied with unrolled moves;
+// larger ones with "rep movsd".
+#define COPY_UNROLL_MAX 32
 
-	if (ty->kind == TY_STRUCT || ty->kind == TY_UNION) {
-		int i;
-		for (i = 0; i < ty->size; i += 1) {
-			// TODO simplify
-			emit("mov_edx,eax");
-			emit("movzx_eax,BYTE_PTR_[eax]");
-			emit("mov_[ebx],al");
-			emit("mov_eax,ebx");
-			emit("add_eax, %1");
-			emit("mov_ebx,eax");
-			emit("mov_eax,edx");
-			emit("add_eax, %1");
+// Copy size bytes from the address in %eax to the address in %ebx. %eax is
+// left unchanged.
+void copy_struct(int size) {
+	int words = size / 4;
+	int i;
+	if (size > COPY_UNROLL_MAX) {
+		emit("mov_esi,eax");
+		emit("mov_edi,ebx");
+		num_postfix("mov_ecx, %", words);
+		emit("rep_movsd");
+		if (size % 4 != 0) {
+			num_postfix("mov_ecx, %", size % 4);
+			emit("rep_movsb");
 		}
 		return;
 	}
 
+	for (i = 0; i < words; i += 1) {
+		num_postfix("mov_ecx,[eax+DWORD] %", i * 4);
+		num_postfix("mov_[ebx+DWORD],ecx %", i * 4);
+	}
+
+	// Copy the tail that is not a whole word.
+	i = words * 4;
+	if (size - i >= 2) {
+		num_postfix("movzx_ecx,WORD_PTR_[eax+DWORD] %", i);
+		num_postfix("mov_[ebx+DWORD],cx %", i);
+		i += 2;
+	}
+	if (size - i == 1) {
+		num_postfix("movzx_ecx,BYTE_PTR_[eax+DWORD] %", i);
+		num_postfix("mov_[ebx+DWORD],cl %", i);
+	}
+}
+
+// Store %eax to the address in %ebx.
+void store_at_ebx(Type *ty) {
+	if (ty->kind == TY_STRUCT || ty->kind == TY_UNION) {
+		copy_struct(ty->size);
+		return;
+	}
+
 	mov_with_size(ty);
 }
 
+// Store %eax to the address in the top of the stack.
+void store(Type *ty) {
+	pop("ebx");
+	store_at_ebx(ty);
+}
+
 #define I8  0
 #define I16 1
 #define I32 2
@@ -185,6 +281,28 @@ int get_type_id(Type *ty) {
 	}
 }
 
+// Returns the type id a value has to be truncated and extended to when
+// cast from `from` to `to`, or -1 if the value is left as is.
+int cast_narrowing(Type *from, Type *to) {
+	int t1 = get_type_id(from);
+	int t2 = get_type_id(to);
+
+	if ((t1 == U8 || t1 == I16 || t1 == U16 || t1 == I32 || t1 == U32)
+			&& t2 == I8) {
+		return I8;
+	} else if ((t1 == I8 || t1 == I16 || t1 == U16 || t1 == I32 || t1 == U32)
+			&& t2 == U8) {
+		return U8;
+	} else if ((t1 == U16 || t1 == I32 || t1 == U32)
+			&& t2 == I16) {
+		return I16;
+	} else if ((t1 == I16 || t1 == I32 || t1 == U32)
+			&& t2 == U16) {
+		return U16;
+	}
+	return -1;
+}
+
 void do_cast(Type *from, Type *to) {
 	if (to->kind == TY_VOID) {
 		return;
@@ -197,125 +315,667 @@ void do_cast(Type *from, Type *to) {
 		emit("movzx_eax,al");
 	}
 
-	int t1 = get_type_id(from);
-	int t2 = get_type_id(to);
+	int t = cast_narrowing(from, to);
+	if (t == I8) {
+		emit("movsx_eax,al");
+	} else if (t == U8) {
+		emit("movzx_eax,al");
+	} else if (t == I16) {
+		emit("movsx_eax,ax");
+	} else if (t == U16) {
+		emit("movzx_eax,ax");
+	}
+}
 
-	if ((t1 == U8 || t1 == I16 || t1 == U16 || t1 == I32 || t1 == U32)
-			&& t2 == I8) {
-		// TODO simplify
-		push("eax");
-		emit("lea_eax,[esp+DWORD] %0");
-		emit("movsx_eax,BYTE_PTR_[eax]");
-		pop("edi"); // irrelevant, just removes from stack
-	} else if ((t1 == I8 || t1 == I16 || t1 == U16 || t1 == I32 || t1 == U32)
-			&& t2 == U8) {
-		push("eax");
-		emit("lea_eax,[esp+DWORD] %0");
-		emit("movzx_eax,BYTE_PTR_[eax]");
-		pop("edi"); // irrelevant, just removes from stack
-	} else if ((t1 == U16 || t1 == I32 || t1 == U32)
-			&& t2 == I16) {
-		push("eax");
-		emit("lea_eax,[esp+DWORD] %0");
-		emit("movsx_eax,WORD_PTR_[eax]");
-		pop("edi"); // irrelevant, just removes from stack
-	} else if ((t1 == I16 || t1 == I32 || t1 == U32)
-			&& t2 == U16) {
-		push("eax");
-		emit("lea_eax,[esp+DWORD] %0");
-		emit("movzx_eax,WORD_PTR_[eax]");
-		pop("edi"); // irrelevant, just removes from stack
+// Returns the name of a label made of a prefix and a suffix, eg "IF_else_"
+// and "3".
+char *label_name(char *prefix, char *suffix) {
+	char *name = calloc(strlen(prefix) + strlen(suffix) + 1, sizeof(char));
+	strcpy(name, prefix);
+	strcat(name, suffix);
+	return name;
+}
+
+void emit_jump(char *insn, char *label) {
+	out_str(insn);
+	out_str(" %");
+	out_str(label);
+	out_char('\n');
+}
+
+//
+// Expression register allocator
+//
+// Expressions without side effects are evaluated into registers instead
+// of through the stack. Registers are handed out in order from a list, so
+// a subexpression evaluated with the list starting at `top` leaves its
+// value in regs[top] and only clobbers registers from there onwards.
+// reg_need() gives the Sethi-Ullman number of an expression; the operand
+// needing more registers is evaluated first, so a tree fits as long as
+// its number is no greater than the registers left. Trees that do not fit
+// are split up by gen_expr(), which spills through the stack.
+//
+
+#define NUM_REGS 6
+
+char **reg_order;          // eax, ebx, ecx, edx, esi, edi
+char **reg_order_swapped;  // ebx, eax, ecx, edx, esi, edi
+
+void init_reg_order(void) {
+	reg_order = calloc(NUM_REGS, sizeof(char*));
+	reg_order[0] = "eax";
+	reg_order[1] = "ebx";
+	reg_order[2] = "ecx";
+	reg_order[3] = "edx";
+	reg_order[4] = "esi";
+	reg_order[5] = "edi";
+
+	// With %ebx busy, this hands out %eax first.
+	reg_order_swapped = calloc(NUM_REGS, sizeof(char*));
+	reg_order_swapped[0] = "ebx";
+	reg_order_swapped[1] = "eax";
+	reg_order_swapped[2] = "ecx";
+	reg_order_swapped[3] = "edx";
+	reg_order_swapped[4] = "esi";
+	reg_order_swapped[5] = "edi";
+}
+
+// Emit "insn_reg"
+void emit_r(char *insn, char *reg) {
+	out_str(insn);
+	out_str("_");
+	out_str(reg);
+	out_char('\n');
+}
+
+// Emit "insn_dst,src"
+void emit_rr(char *insn, char *dst, char *src) {
+	out_str(insn);
+	out_str("_");
+	out_str(dst);
+	out_str(",");
+	out_str(src);
+	out_char('\n');
+}
+
+// Emit "insn_reg, imm"
+void emit_ri(char *insn, char *reg, char *imm) {
+	out_str(insn);
+	out_str("_");
+	out_str(reg);
+	out_str(", ");
+	out_str(imm);
+	out_char('\n');
+}
+
+// Returns true if the address of a given node is a fixed offset from %ebp.
+int is_frame_addr(Node *node) {
+	if (node->kind == ND_VAR) {
+		return node->var->is_local;
+	}
+	if (node->kind == ND_MEMBER) {
+		return is_frame_addr(node->lhs);
 	}
+	return FALSE;
 }
 
-// Generate code for a given node.
-void gen_expr(Node *node) {
-	if (node->kind == ND_NULL_EXPR) {
+int frame_offset(Node *node) {
+	if (node->kind == ND_MEMBER) {
+		return frame_offset(node->lhs) + node->member->offset;
+	}
+	return node->var->offset;
+}
+
+int reg_need(Node *node);
+
+// Returns the number of registers needed to compute the address of a
+// given node, or 0 if it cannot be computed in registers.
+int reg_addr_need(Node *node) {
+	if (node->kind == ND_VAR) {
+		if (node->ty->kind == TY_FUNC) {
+			return 0;
+		}
+		return 1;
+	} else if (node->kind == ND_DEREF) {
+		return reg_need(node->lhs);
+	} else if (node->kind == ND_MEMBER) {
+		return reg_addr_need(node->lhs);
+	}
+	return 0;
+}
+
+// Returns true for binary operators that have a form taking an immediate.
+int has_imm_form(int kind) {
+	return kind == ND_ADD || kind == ND_SUB || kind == ND_MUL ||
+		kind == ND_BITAND || kind == ND_BITOR || kind == ND_BITXOR ||
+		kind == ND_SHL || kind == ND_SHR;
+}
+
+// Returns the number of registers needed to evaluate a given node, or 0
+// if it cannot be evaluated in registers.
+int reg_need(Node *node) {
+	int kind = node->kind;
+	Type *ty = node->ty;
+	if (!ty || ty->kind == TY_STRUCT || ty->kind == TY_UNION || ty->kind == TY_FUNC) {
+		return 0;
+	}
+
+	if (kind == ND_NUM) {
+		return 1;
+	} else if (kind == ND_VAR || kind == ND_MEMBER) {
+		return reg_addr_need(node);
+	} else if (kind == ND_DEREF || kind == ND_NEG || kind == ND_BITNOT) {
+		return reg_need(node->lhs);
+	} else if (kind == ND_ADDR) {
+		return reg_addr_need(node->lhs);
+	} else if (kind == ND_CAST) {
+		if (ty->kind == TY_VOID || ty->kind == TY_BOOL) {
+			return 0;
+		}
+		return reg_need(node->lhs);
+	}
+
+	if (!has_imm_form(kind)) {
+		return 0;
+	}
+
+	int l = reg_need(node->lhs);
+	if (l == 0 || node->rhs->kind == ND_NUM) {
+		return l;
+	}
+	// Shift counts have to be constants, as %cl may be in use.
+	if (kind == ND_SHL || kind == ND_SHR) {
+		return 0;
+	}
+	int r = reg_need(node->rhs);
+	if (r == 0) {
+		return 0;
+	}
+	if (l == r) {
+		return l + 1;
+	}
+	if (l > r) {
+		return l;
+	}
+	return r;
+}
+
+// Returns the instruction loading a value of a given type into a
+// register, eg "movsx_ebx,BYTE_PTR_". The memory operand follows it.
+char *load_insn(Type *ty, char *reg) {
+	char *insn;
+	if (ty->size == 1 || ty->size == 2) {
+		if (ty->is_unsigned) {
+			insn = label_name("movzx_", reg);
+		} else {
+			insn = label_name("movsx_", reg);
+		}
+		if (ty->size == 1) {
+			return label_name(insn, ",BYTE_PTR_");
+		}
+		return label_name(insn, ",WORD_PTR_");
+	}
+	insn = label_name("mov_", reg);
+	return label_name(insn, ",");
+}
+
+// Load a value from ebp+offset into a register.
+void load_frame(Type *ty, char *reg, int offset) {
+	if (ty->kind == TY_ARRAY) {
+		out_str("lea_");
+		out_str(reg);
+		out_str(",");
+	} else {
+		out_str(load_insn(ty, reg));
+	}
+	str_postfix("[ebp+DWORD] %", int2str(offset, 10, TRUE));
+}
+
+// Load a value from the address in a register into the same register.
+void load_reg(Type *ty, char *reg) {
+	if (ty->kind == TY_ARRAY) {
 		return;
-	} else if (node->kind == ND_NUM) {
-		num_postfix("mov_eax, %", node->val);
+	}
+	out_str(load_insn(ty, reg));
+	out_str("[");
+	out_str(reg);
+	out_str("]\n");
+}
+
+void gen_reg(Node *node, char **regs, int top);
+
+// Compute the address of a given node into regs[top].
+void gen_reg_addr(Node *node, char **regs, int top) {
+	char *reg = regs[top];
+	if (is_frame_addr(node)) {
+		out_str("lea_");
+		out_str(reg);
+		str_postfix(",[ebp+DWORD] %", int2str(frame_offset(node), 10, TRUE));
+	} else if (node->kind == ND_VAR) {
+		emit_global_addr(reg, node->var);
+	} else if (node->kind == ND_DEREF) {
+		gen_reg(node->lhs, regs, top);
+	} else {
+		// ND_MEMBER
+		gen_reg_addr(node->lhs, regs, top);
+		if (node->member->offset != 0) {
+			emit_ri("add", reg, label_name("%", uint2str(node->member->offset)));
+		}
+	}
+}
+
+// Returns the instruction name of a binary operator.
+char *binary_insn(int kind) {
+	if (kind == ND_ADD) {
+		return "add";
+	} else if (kind == ND_SUB) {
+		return "sub";
+	} else if (kind == ND_MUL) {
+		return "imul";
+	} else if (kind == ND_BITAND) {
+		return "and";
+	} else if (kind == ND_BITOR) {
+		return "or";
+	}
+	return "xor";
+}
+
+// Truncate and extend a register to the type with id t, as returned by
+// cast_narrowing().
+void gen_reg_cast(int t, char *reg) {
+	if (t == I8) {
+		emit_ri("shl", reg, "!24");
+		emit_ri("sar", reg, "!24");
+	} else if (t == U8) {
+		emit_ri("and", reg, "%255");
+	} else if (t == I16) {
+		emit_ri("shl", reg, "!16");
+		emit_ri("sar", reg, "!16");
+	} else if (t == U16) {
+		emit_ri("and", reg, "%65535");
+	}
+}
+
+// Evaluate a given node into regs[top], clobbering only registers from
+// regs[top] onwards. reg_need(node) must be at most NUM_REGS - top.
+void gen_reg(Node *node, char **regs, int top) {
+	char *reg = regs[top];
+	int kind = node->kind;
+
+	if (kind == ND_NUM) {
+		emit_ri("mov", reg, label_name("%", uint2str(node->val)));
 		return;
-	} else if (node->kind == ND_NEG) {
-		gen_expr(node->lhs);
-		emit("mov_ebx, %0");
-		emit("sub_ebx,eax");
-		emit("mov_eax,ebx");
+	} else if (kind == ND_VAR || kind == ND_MEMBER) {
+		if (is_frame_addr(node)) {
+			load_frame(node->ty, reg, frame_offset(node));
+			return;
+		}
+		gen_reg_addr(node, regs, top);
+		load_reg(node->ty, reg);
 		return;
-	} else if (node->kind == ND_VAR || node->kind == ND_MEMBER) {
-		gen_addr(node);
-		load(node->ty);
+	} else if (kind == ND_DEREF) {
+		gen_reg(node->lhs, regs, top);
+		load_reg(node->ty, reg);
 		return;
-	} else if (node->kind == ND_DEREF) {
-		gen_expr(node->lhs);
-		load(node->ty);
+	} else if (kind == ND_ADDR) {
+		gen_reg_addr(node->lhs, regs, top);
 		return;
-	} else if (node->kind == ND_ADDR) {
-		gen_addr(node->lhs);
+	} else if (kind == ND_CAST) {
+		gen_reg(node->lhs, regs, top);
+		gen_reg_cast(cast_narrowing(node->lhs->ty, node->ty), reg);
 		return;
-	} else if (node->kind == ND_ASSIGN) {
-		gen_addr(node->lhs);
-		push("eax");
-		gen_expr(node->rhs);
-		store(node->ty);
+	} else if (kind == ND_NEG) {
+		gen_reg(node->lhs, regs, top);
+		emit_r("neg", reg);
 		return;
-	} else if (node->kind == ND_STMT_EXPR) {
-		Node *n;
-		for (n = node->body; n; n = n->next) {
-			gen_stmt(n);
+	} else if (kind == ND_BITNOT) {
+		gen_reg(node->lhs, regs, top);
+		emit_r("not", reg);
+		return;
+	}
+
+	// Binary
+	if (node->rhs->kind != ND_NUM && reg_need(node->rhs) > reg_need(node->lhs)) {
+		gen_reg(node->rhs, regs, top);
+		gen_reg(node->lhs, regs, top + 1);
+		if (kind == ND_SUB) {
+			emit_rr("sub", regs[top + 1], reg);
+			emit_rr("mov", reg, regs[top + 1]);
+		} else {
+			emit_rr(binary_insn(kind), reg, regs[top + 1]);
 		}
 		return;
-	} else if (node->kind == ND_COMMA) {
-		gen_expr(node->lhs);
-		gen_expr(node->rhs);
+	}
+
+	gen_reg(node->lhs, regs, top);
+	if (node->rhs->kind == ND_NUM) {
+		if (kind == ND_SHL) {
+			emit_ri("shl", reg, label_name("!", uint2str(node->rhs->val & 31)));
+		} else if (kind == ND_SHR) {
+			if (node->lhs->ty->is_unsigned) {
+				emit_ri("shr", reg, label_name("!", uint2str(node->rhs->val & 31)));
+			} else {
+				emit_ri("sar", reg, label_name("!", uint2str(node->rhs->val & 31)));
+			}
+		} else {
+			emit_ri(binary_insn(kind), reg, label_name("%", uint2str(node->rhs->val)));
+		}
 		return;
-	} else if (node->kind == ND_CAST) {
+	}
+	gen_reg(node->rhs, regs, top + 1);
+	emit_rr(binary_insn(kind), reg, regs[top + 1]);
+}
+
+// Evaluate the operands of a binary node, the left one into %eax and the
+// right one into %ebx.
+void gen_operands(Node *node) {
+	int need = reg_need(node->rhs);
+	if (need != 0 && need < NUM_REGS) {
 		gen_expr(node->lhs);
-		do_cast(node->lhs->ty, node->ty);
+		gen_reg(node->rhs, reg_order, 1);
 		return;
-	} else if (node->kind == ND_MEMZERO) {
-		gen_addr(node);
+	}
+
+	need = reg_need(node->lhs);
+	if (need != 0 && need < NUM_REGS) {
+		gen_expr(node->rhs);
 		emit("mov_ebx,eax");
-		int i;
-		for (i = 0; i < node->var->ty->size; i += 1) {
-			emit("mov_eax, %0");
-			emit("mov_[ebx],al");
-			emit("mov_eax, %1");
-			emit("add_ebx,eax");
+		gen_reg(node->lhs, reg_order_swapped, 1);
+		return;
+	}
+
+	// Spill the left operand while the right one is evaluated.
+	gen_expr(node->lhs);
+	push("eax");
+	gen_expr(node->rhs);
+	emit("mov_ebx,eax");
+	pop("eax");
+}
+
+// Returns the conditional jump taken when a comparison of kind `kind` is
+// true, or when it is false if `negate` is set.
+char *compare_jump(int kind, int is_unsigned, int negate) {
+	if (kind == ND_EQ) {
+		if (negate) {
+			return "jne";
+		}
+		return "je";
+	} else if (kind == ND_NE) {
+		if (negate) {
+			return "je";
+		}
+		return "jne";
+	} else if (kind == ND_LT) {
+		if (is_unsigned) {
+			if (negate) {
+				return "jae";
+			}
+			return "jb";
+		}
+		if (negate) {
+			return "jge";
+		}
+		return "jl";
+	}
+
+	// ND_LE
+	if (is_unsigned) {
+		if (negate) {
+			return "ja";
+		}
+		return "jbe";
+	}
+	if (negate) {
+		return "jg";
+	}
+	return "jle";
+}
+
+// Returns the instruction setting %al to the result of a comparison.
+char *compare_set(int kind, int is_unsigned) {
+	if (kind == ND_EQ) {
+		return "sete_al";
+	} else if (kind == ND_NE) {
+		return "setne_al";
+	} else if (kind == ND_LT) {
+		if (is_unsigned) {
+			return "setb_al";
+		}
+		return "setl_al";
+	}
+	if (is_unsigned) {
+		return "setbe_al";
+	}
+	return "setle_al";
+}
+
+// Generate code that jumps to `label` if the truth value of `node` is
+// `when`, and falls through otherwise. Comparisons branch directly on the
+// flags from a single cmp, and logical operators are short-circuited into
+// jumps, so no 0/1 value is materialised.
+void gen_jump_if(Node *node, int when, char *label) {
+	if (node->kind == ND_NUM) {
+		if ((node->val != 0) == when) {
+			emit_jump("jmp", label);
 		}
 		return;
-	} else if (node->kind == ND_COND) {
-		int c = count();
-		gen_expr(node->cond);
-		emit("mov_ebx, %0");
-		emit("cmp");
-		num_postfix("je %COND_else_", c);
-		gen_expr(node->then);
-		num_postfix("jmp %COND_end_", c);
-		num_postfix(":COND_else_", c);
-		gen_expr(node->els);
-		num_postfix(":COND_end_", c);
+	}
+
+	if (node->kind == ND_NOT) {
+		gen_jump_if(node->lhs, !when, label);
 		return;
-	} else if (node->kind == ND_NOT) {
-		gen_expr(node->lhs);
-		emit("mov_ebx, %0");
-		emit("cmp");
-		emit("sete_al");
-		emit("movzx_eax,al");
+	}
+
+	char *skip;
+	if (node->kind == ND_LOGAND) {
+		if (when) {
+			skip = label_name("LOGAND_skip_", uint2str(count()));
+			gen_jump_if(node->lhs, FALSE, skip);
+			gen_jump_if(node->rhs, TRUE, label);
+			str_postfix(":", skip);
+		} else {
+			gen_jump_if(node->lhs, FALSE, label);
+			gen_jump_if(node->rhs, FALSE, label);
+		}
 		return;
-	} else if (node->kind == ND_BITNOT) {
-		gen_expr(node->lhs);
-		emit("not_eax");
+	}
+
+	if (node->kind == ND_LOGOR) {
+		if (when) {
+			gen_jump_if(node->lhs, TRUE, label);
+			gen_jump_if(node->rhs, TRUE, label);
+		} else {
+			skip = label_name("LOGOR_skip_", uint2str(count()));
+			gen_jump_if(node->lhs, TRUE, skip);
+			gen_jump_if(node->rhs, FALSE, label);
+			str_postfix(":", skip);
+		}
 		return;
-	} else if (node->kind == ND_LOGAND) {
-		int c = count();
+	}
+
+	if (node->kind == ND_EQ || node->kind == ND_NE ||
+			node->kind == ND_LT || node->kind == ND_LE) {
+		gen_operands(node);
+		emit("cmp_eax,ebx");
+		emit_jump(compare_jump(node->kind, node->lhs->ty->is_unsigned, !when), label);
+		return;
+	}
+
+	gen_expr(node);
+	emit("test_eax,eax");
+	if (when) {
+		emit_jump("jne", label);
+	} else {
+		emit_jump("je", label);
+	}
+}
+
+void emit_call(char *funcname) {
+	out_str("call %FUNCTION_");
+	// Handle static functions
+	Obj *fn;
+	for (fn = functions; fn; fn = fn->next) {
+		if (funcname == fn->name) {
+			if (fn->is_static) {
+				out_str(uint2str(infile_id));
+				out_str("_");
+			}
+			break;
+		}
+	}
+	out_str(funcname);
+	out_char('\n');
+}
+
+// There may be garbage in the top part of a return value from a function
+// with a size less than the word size.
+void fix_return_value(Type *ty) {
+	if (ty->kind == TY_BOOL) {
+		emit("movzx_eax,al");
+	} else if (ty->kind == TY_CHAR) {
+		if (ty->is_unsigned) {
+			emit("movzx_eax,al");
+		} else {
+			emit("movsx_eax,al");
+		}
+	} else if (ty->kind == TY_SHORT) {
+		if (ty->is_unsigned) {
+			emit("movzx_eax,ax");
+		} else {
+			emit("movsx_eax,ax");
+		}
+	}
+}
+
+// Objects up to this many bytes are zeroed with unrolled stores; larger
+// ones with "rep stosd".
+#define MEMZERO_UNROLL_MAX 64
+
+// Zero-clear size bytes of the stack frame starting at ebp+offset.
+void gen_memzero(int offset, int size) {
+	emit("mov_eax, %0");
+
+	int words = size / 4;
+	int i;
+	if (size > MEMZERO_UNROLL_MAX) {
+		str_postfix("lea_edi,[ebp+DWORD] %", int2str(offset, 10, TRUE));
+		num_postfix("mov_ecx, %", words);
+		emit("rep_stosd");
+	} else {
+		for (i = 0; i < words; i += 1) {
+			str_postfix("mov_[ebp+DWORD],eax %", int2str(offset + i * 4, 10, TRUE));
+		}
+	}
+
+	// Clear the tail that is not a whole word.
+	i = words * 4;
+	if (size - i >= 2) {
+		str_postfix("mov_[ebp+DWORD],ax %", int2str(offset + i, 10, TRUE));
+		i += 2;
+	}
+	if (size - i == 1) {
+		str_postfix("mov_[ebp+DWORD],al %", int2str(offset + i, 10, TRUE));
+	}
+}
+
+// Generate code for a given node.
+void gen_expr(Node *node) {
+	int need = reg_need(node);
+	if (need != 0 && need <= NUM_REGS) {
+		gen_reg(node, reg_order, 0);
+		return;
+	}
+
+	if (node->kind == ND_NULL_EXPR) {
+		return;
+	} else if (node->kind == ND_NUM) {
+		num_postfix("mov_eax, %", node->val);
+		return;
+	} else if (node->kind == ND_NEG) {
 		gen_expr(node->lhs);
 		emit("mov_ebx, %0");
-		emit("cmp");
-		num_postfix("je %LOGAND_false_", c);
+		emit("sub_ebx,eax");
+		emit("mov_eax,ebx");
+		return;
+	} else if (node->kind == ND_VAR || node->kind == ND_MEMBER) {
+		gen_addr(node);
+		load(node->ty);
+		return;
+	} else if (node->kind == ND_DEREF) {
+		gen_expr(node->lhs);
+		load(node->ty);
+		return;
+	} else if (node->kind == ND_ADDR) {
+		gen_addr(node->lhs);
+		return;
+	} else if (node->kind == ND_ASSIGN) {
+		Type *ty = node->ty;
+		int is_aggregate = ty->kind == TY_STRUCT || ty->kind == TY_UNION;
+		if (is_frame_addr(node->lhs) && !is_aggregate) {
+			gen_expr(node->rhs);
+			char *off = int2str(frame_offset(node->lhs), 10, TRUE);
+			if (ty->size == 1) {
+				str_postfix("mov_[ebp+DWORD],al %", off);
+			} else if (ty->size == 2) {
+				str_postfix("mov_[ebp+DWORD],ax %", off);
+			} else {
+				str_postfix("mov_[ebp+DWORD],eax %", off);
+			}
+			return;
+		}
+		need = reg_addr_need(node->lhs);
+		if (need != 0 && need < NUM_REGS) {
+			gen_expr(node->rhs);
+			gen_reg_addr(node->lhs, reg_order, 1);
+			store_at_ebx(ty);
+			return;
+		}
+
+		gen_addr(node->lhs);
+		push("eax");
+		gen_expr(node->rhs);
+		store(node->ty);
+		return;
+	} else if (node->kind == ND_STMT_EXPR) {
+		Node *n;
+		for (n = node->body; n; n = n->next) {
+			gen_stmt(n);
+		}
+		return;
+	} else if (node->kind == ND_COMMA) {
+		gen_expr(node->lhs);
 		gen_expr(node->rhs);
+		return;
+	} else if (node->kind == ND_CAST) {
+		gen_expr(node->lhs);
+		do_cast(node->lhs->ty, node->ty);
+		return;
+	} else if (node->kind == ND_MEMZERO) {
+		gen_memzero(node->var->offset, node->var->ty->size);
+		return;
+	} else if (node->kind == ND_COND) {
+		int c = count();
+		gen_jump_if(node->cond, FALSE, label_name("COND_else_", uint2str(c)));
+		gen_expr(node->then);
+		num_postfix("jmp %COND_end_", c);
+		num_postfix(":COND_else_", c);
+		gen_expr(node->els);
+		num_postfix(":COND_end_", c);
+		return;
+	} else if (node->kind == ND_NOT) {
+		gen_expr(node->lhs);
 		emit("mov_ebx, %0");
 		emit("cmp");
-		num_postfix("je %LOGAND_false_", c);
+		emit("sete_al");
+		emit("movzx_eax,al");
+		return;
+	} else if (node->kind == ND_BITNOT) {
+		gen_expr(node->lhs);
+		emit("not_eax");
+		return;
+	} else if (node->kind == ND_LOGAND) {
+		int c = count();
+		gen_jump_if(node, FALSE, label_name("LOGAND_false_", uint2str(c)));
 		emit("mov_eax, %1");
 		num_postfix("jmp %LOGAND_end_", c);
 		num_postfix(":LOGAND_false_", c);
@@ -324,14 +984,7 @@ void gen_expr(Node *node) {
 		return;
 	} else if (node->kind == ND_LOGOR) {
 		int c = count();
-		gen_expr(node->lhs);
-		emit("mov_ebx, %0");
-		emit("cmp");
-		num_postfix("jne %LOGOR_true_", c);
-		gen_expr(node->rhs);
-		emit("mov_ebx, %0");
-		emit("cmp");
-		num_postfix("jne %LOGOR_true_", c);
+		gen_jump_if(node, TRUE, label_name("LOGOR_true_", uint2str(c)));
 		emit("mov_eax, %0");
 		num_postfix("jmp %LOGOR_end_", c);
 		num_postfix(":LOGOR_true_", c);
@@ -366,21 +1019,7 @@ void gen_expr(Node *node) {
 		}
 
 		emit("mov_eax, %0");
-
-		fputs("call %FUNCTION_", output_file);
-		// Handle static functions
-		Obj *fn;
-		for (fn = functions; fn; fn = fn->next) {
-			if (!strcmp(node->funcname, fn->name)) {
-				if (fn->is_static) {
-					fputs(uint2str(infile_id), output_file);
-					fputs("_", output_file);
-				}
-				break;
-			}
-		}
-		fputs(node->funcname, output_file);
-		fputc('\n', output_file);
+		emit_call(node->funcname);
 
 		// Stack cleanup
 		num_postfix("add_esp, %", nargs * 4);
@@ -388,56 +1027,23 @@ void gen_expr(Node *node) {
 			emit("add_esp, %8");
 		}
 
-		// There may be garbage in the top part of a return value from a
-		// function with a size less than the word size.
-		// TODO simplify
-		if (node->ty->kind == TY_BOOL ||
-				node->ty->kind == TY_CHAR ||
-				node->ty->kind == TY_SHORT) {
-			push("eax");
-			emit("lea_eax,[esp+DWORD] %0");
-			if (node->ty->kind == TY_BOOL) {
-				emit("movzx_eax,BYTE_PTR_[eax]");
-			} else if (node->ty->kind == TY_CHAR) {
-				if (node->ty->is_unsigned) {
-					emit("movzx_eax,BYTE_PTR_[eax]");
-				} else {
-					emit("movsx_eax,BYTE_PTR_[eax]");
-				}
-			} else if (node->ty->kind == TY_SHORT) {
-				if (node->ty->is_unsigned) {
-					emit("movzx_eax,WORD_PTR_[eax]");
-				} else {
-					emit("movsx_eax,WORD_PTR_[eax]");
-				}
-			}
-			pop("edi");
-		}
-
+		fix_return_value(node->ty);
 		return;
 	}
 
 	// Binary
-	gen_expr(node->rhs);
-	push("eax");
-	gen_expr(node->lhs);
+	gen_operands(node);
 
 	if (node->kind == ND_ADD) {
-		pop("ebx");
 		emit("add_eax,ebx");
 		return;
 	} else if (node->kind == ND_SUB) {
-		emit("mov_ebx,eax");
-		pop("eax");
-		emit("sub_ebx,eax");
-		emit("mov_eax,ebx");
+		emit("sub_eax,ebx");
 		return;
 	} else if (node->kind == ND_MUL) {
-		pop("ebx");
-		emit("imul_ebx");
+		emit("imul_eax,ebx");
 		return;
 	} else if (node->kind == ND_DIV || node->kind == ND_MOD) {
-		pop("ebx");
 		if (node->ty->is_unsigned) {
 			emit("mov_edx, %0");
 			emit("div_ebx");
@@ -450,55 +1056,26 @@ void gen_expr(Node *node) {
 		}
 		return;
 	} else if (node->kind == ND_BITAND) {
-		pop("ebx");
 		emit("and_eax,ebx");
 		return;
 	} else if (node->kind == ND_BITOR) {
-		pop("ebx");
 		emit("or_eax,ebx");
 		return;
 	} else if (node->kind == ND_BITXOR) {
-		pop("ebx");
 		emit("xor_eax,ebx");
 		return;
 	} else if (node->kind == ND_EQ || node->kind == ND_NE ||
 			node->kind == ND_LT || node->kind == ND_LE) {
-		emit("mov_ebx,eax");
-		pop("eax");
-		emit("cmp");
-		if (node->kind == ND_EQ) {
-			emit("sete_al");
-		} else if (node->kind == ND_NE) {
-			emit("setne_al");
-		} else if (node->kind == ND_LT) {
-			if (node->lhs->ty->is_unsigned) {
-				emit("setb_al");
-			} else {
-				emit("setl_al");
-			}
-		} else if (node->kind == ND_LE) {
-			if (node->lhs->ty->is_unsigned) {
-				emit("setbe_al");
-			} else {
-				emit("setle_al");
-			}
-		}
+		emit("cmp_eax,ebx");
+		emit(compare_set(node->kind, node->lhs->ty->is_unsigned));
 		emit("movzx_eax,al");
 		return;
 	} else if (node->kind == ND_SHL) {
-		// TODO simplify
-		emit("mov_ebx,eax");
-		pop("eax");
-		emit("mov_ecx,eax");
-		emit("mov_eax,ebx");
+		emit("mov_ecx,ebx");
 		emit("shl_eax,cl");
 		return;
 	} else if (node->kind == ND_SHR) {
-		// TODO simplify
-		emit("mov_ebx,eax");
-		pop("eax");
-		emit("mov_ecx,eax");
-		emit("mov_eax,ebx");
+		emit("mov_ecx,ebx");
 		if (node->lhs->ty->is_unsigned) {
 			emit("shr_eax,cl");
 		} else {
@@ -510,13 +1087,150 @@ void gen_expr(Node *node) {
 	error_tok(node->tok, "invalid expression");
 }
 
+// Switches with fewer cases than this compare against each case in turn.
+#define SWITCH_LINEAR_MAX 4
+
+// Returns true if case value a orders before b.
+int case_less(int32_t a, int32_t b, int is_unsigned) {
+	if (is_unsigned) {
+		uint32_t ua = a;
+		uint32_t ub = b;
+		return ua < ub;
+	}
+	return a < b;
+}
+
+// Emit compares of %eax against cases[lo..hi] in turn, falling back to
+// the default label.
+void gen_case_chain(Node **cases, int lo, int hi, char *default_label) {
+	int i;
+	for (i = lo; i <= hi; i += 1) {
+		num_postfix("mov_ebx, %", cases[i]->val);
+		emit("cmp");
+		emit_jump("je", label_name("LABEL_", cases[i]->label));
+	}
+	emit_jump("jmp", default_label);
+}
+
+// Emit a balanced binary search over the sorted cases[lo..hi].
+void gen_case_tree(Node **cases, int lo, int hi, char *default_label, int is_unsigned) {
+	if (hi - lo < SWITCH_LINEAR_MAX) {
+		gen_case_chain(cases, lo, hi, default_label);
+		return;
+	}
+
+	int mid = (lo + hi) / 2;
+	char *lower = label_name("SWITCH_lower_", uint2str(count()));
+
+	// The flags are those of case value - %eax.
+	num_postfix("mov_ebx, %", cases[mid]->val);
+	emit("cmp");
+	emit_jump("je", label_name("LABEL_", cases[mid]->label));
+	if (is_unsigned) {
+		emit_jump("ja", lower);
+	} else {
+		emit_jump("jg", lower);
+	}
+	gen_case_tree(cases, mid + 1, hi, default_label, is_unsigned);
+	str_postfix(":", lower);
+	gen_case_tree(cases, lo, mid - 1, default_label, is_unsigned);
+}
+
+// Emit an indirect jump through a table covering every value from the
+// smallest to the largest case.
+void gen_jump_table(Node **cases, int ncases, char *default_label) {
+	JumpTable *table = calloc(1, sizeof(JumpTable));
+	table->id = count();
+	table->cases = cases;
+	table->ncases = ncases;
+	table->default_label = default_label;
+	table->next = jump_tables;
+	jump_tables = table;
+
+	uint32_t range = cases[ncases - 1]->val - cases[0]->val;
+
+	// Values outside of the table go to the default label. After
+	// subtracting the smallest case, this is one unsigned compare.
+	num_postfix("sub_eax, %", cases[0]->val);
+	num_postfix("mov_ebx, %", range);
+	emit("cmp");
+	emit_jump("jb", default_label);
+	emit("sal_eax, !2");
+	num_postfix("add_eax, &SWITCH_table_", table->id);
+	emit("mov_eax,[eax]");
+	emit("jmp_eax");
+}
+
+// Emit the dispatch for a switch statement whose controlling value is in
+// %eax. Tiny switches compare against each case, dense ones jump through
+// a table, and sparse ones do a binary search.
+void gen_switch(Node *node) {
+	int is_unsigned = node->cond->ty->is_unsigned;
+	char *default_label;
+	if (node->default_case) {
+		default_label = label_name("LABEL_", node->default_case->label);
+	} else {
+		default_label = label_name("LABEL_", node->brk_label);
+	}
+
+	int ncases = 0;
+	Node *n;
+	for (n = node->case_next; n; n = n->case_next) {
+		ncases += 1;
+	}
+
+	if (ncases == 0) {
+		emit_jump("jmp", default_label);
+		return;
+	}
+
+	// The list is in reverse source order. Put the cases back in source
+	// order first, so that the insertion sort below takes linear time on
+	// the usual switch written in increasing order.
+	Node **cases = calloc(ncases, sizeof(Node*));
+	int i = ncases;
+	for (n = node->case_next; n; n = n->case_next) {
+		i -= 1;
+		cases[i] = n;
+	}
+
+	// Sort the cases by value, keeping equal ones in source order.
+	int j;
+	for (i = 1; i < ncases; i += 1) {
+		n = cases[i];
+		j = i;
+		while (j > 0 && case_less(n->val, cases[j - 1]->val, is_unsigned)) {
+			cases[j] = cases[j - 1];
+			j -= 1;
+		}
+		cases[j] = n;
+	}
+
+	for (i = 1; i < ncases; i += 1) {
+		if (cases[i]->val == cases[i - 1]->val) {
+			error_tok(cases[i]->tok, "duplicate case value");
+		}
+	}
+
+	if (ncases < SWITCH_LINEAR_MAX) {
+		gen_case_chain(cases, 0, ncases - 1, default_label);
+		return;
+	}
+
+	// A table is worth it if at least a third of its entries are cases.
+	uint32_t range = cases[ncases - 1]->val - cases[0]->val;
+	if (range / 3 < (uint32_t)ncases) {
+		gen_jump_table(cases, ncases, default_label);
+		return;
+	}
+
+	gen_case_tree(cases, 0, ncases - 1, default_label, is_unsigned);
+}
+
 void gen_stmt(Node *node) {
 	if (node->kind == ND_IF) {
 		int c = count();
-		gen_expr(node->cond);
-		emit("mov_ebx, %0");
-		emit("cmp");
-		num_postfix("je %IF_else_", c);
+		gen_jump_if(node->cond, FALSE, label_name("IF_else_", uint2str(c)));
 		gen_stmt(node->then);
 		num_postfix("jmp %IF_end_", c);
 		num_postfix(":IF_else_", c);
@@ -532,10 +1246,7 @@ void gen_stmt(Node *node) {
 		}
 		num_postfix(":FOR_begin_", c);
 		if (node->cond != NULL) {
-			gen_expr(node->cond);
-			emit("mov_ebx, %0");
-			emit("cmp");
-			str_postfix("je %LABEL_", node->brk_label);
+			gen_jump_if(node->cond, FALSE, label_name("LABEL_", node->brk_label));
 		}
 		gen_stmt(node->then);
 		str_postfix(":LABEL_", node->cont_label);
@@ -550,27 +1261,12 @@ void gen_stmt(Node *node) {
 		num_postfix(":DO_begin_", c);
 		gen_stmt(node->then);
 		str_postfix(":LABEL_", node->cont_label);
-		gen_expr(node->cond);
-		emit("mov_ebx, %0");
-		emit("cmp");
-		num_postfix("jne %DO_begin_", c);
+		gen_jump_if(node->cond, TRUE, label_name("DO_begin_", uint2str(c)));
 		str_postfix(":LABEL_", node->brk_label);
 		return;
 	} else if (node->kind == ND_SWITCH) {
 		gen_expr(node->cond);
-
-		Node *n;
-		for (n = node->case_next; n; n = n->case_next) {
-			num_postfix("mov_ebx, %", n->val);
-			emit("cmp");
-			str_postfix("je %LABEL_", n->label);
-		}
-
-		if (node->default_case) {
-			str_postfix("jmp %LABEL_", node->default_case->label);
-		}
-
-		str_postfix("jmp %LABEL_", node->brk_label);
+		gen_switch(node);
 		gen_stmt(node->then);
 		str_postfix(":LABEL_", node->brk_label);
 		return;
@@ -625,138 +1321,862 @@ void assign_lvar_offsets(Obj *prog) {
 	}
 }
 
+// Relocations pointing at a label are resolved by hex2 when linking:
+// the start of a variable or function, or a label placed inside the data
+// of a variable defined in this file. Others are applied at run time in
+// main().
+int is_link_time_reloc(Relocation *rel) {
+	Obj *var = rel->var;
+	if (rel->addend == 0) {
+		return TRUE;
+	}
+	if (var->is_function || !var->is_definition) {
+		return FALSE;
+	}
+	if (rel->addend < 0 || rel->addend > var->ty->size) {
+		return FALSE;
+	}
+
+	// No label can be placed inside the target's own pointer slots.
+	Relocation *slot;
+	for (slot = var->rel; slot; slot = slot->next) {
+		if (slot->offset < rel->addend && rel->addend < slot->offset + 4) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+int defines_main(Obj *prog) {
+	Obj *fn;
+	for (fn = prog; fn; fn = fn->next) {
+		if (fn->is_function && fn->is_definition && !strcmp(fn->name, "main")) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// Decide how each relocation is applied, and mark the offsets into each
+// variable that relocations point at, so that labels are emitted there.
+// This runs before any data is emitted, as emitting run-time relocations
+// relinks them into the relocations list.
+void mark_reloc_targets(Obj *prog) {
+	int has_main = defines_main(prog);
+	Obj *var;
+	Obj *target;
+	Relocation *rel;
+	for (var = prog; var; var = var->next) {
+		for (rel = var->rel; rel; rel = rel->next) {
+			rel->at_run_time = !is_link_time_reloc(rel);
+			// Nothing would run the fixup and the pointer would stay NULL.
+			if (rel->at_run_time && !has_main) {
+				error_tok(var->tok, "initializer address can only be computed in the file defining main");
+			}
+			if (rel->addend == 0 || rel->at_run_time) {
+				continue;
+			}
+			target = rel->var;
+			if (!target->reloc_targets) {
+				target->reloc_targets = calloc(target->ty->size + 1, sizeof(char));
+			}
+			target->reloc_targets[rel->addend] = TRUE;
+		}
+	}
+}
+
+// Label at offset pos into a variable
+void emit_addend_label(char *prefix, Obj *var, int pos) {
+	out_str(prefix);
+	out_str("ADDEND_");
+	out_str(uint2str(pos));
+	emit_symbol("_GLOBAL_", var);
+}
+
+// Initialised data is written as raw hex strings of at most this many
+// bytes per line.
+#define DATA_CHUNK_SIZE 32
+
+// Number of bytes in the hex string being written
+int data_run;
+
+void end_data_run(void) {
+	if (data_run == 0) {
+		return;
+	}
+	out_char('\'');
+	out_char('\n');
+	data_run = 0;
+}
+
+void emit_data_byte(int c) {
+	char *digits = "0123456789ABCDEF";
+	if (data_run == 0) {
+		out_char('\'');
+	}
+	out_char(digits[(c >> 4) & 15]);
+	out_char(digits[c & 15]);
+	data_run += 1;
+	if (data_run == DATA_CHUNK_SIZE) {
+		end_data_run();
+	}
+}
+
+void emit_reloc_target(Obj *var, int pos) {
+	if (!var->reloc_targets) {
+		return;
+	}
+	if (!var->reloc_targets[pos]) {
+		return;
+	}
+	end_data_run();
+	out_char('\n');
+	emit_addend_label(":", var, pos);
+	out_char('\n');
+}
+
+void emit_reloc(Relocation *rel) {
+	Obj *var = rel->var;
+	end_data_run();
+	if (rel->at_run_time) {
+		rel->id = reloc_id;
+		out_char('\n');
+		num_postfix(":REL_", reloc_id);
+		emit("%0");
+		reloc_id += 1;
+		rel->next = relocations;
+		relocations = rel;
+		return;
+	}
+
+	if (var->is_function) {
+		emit_symbol("&FUNCTION_", var);
+	} else if (rel->addend == 0) {
+		emit_symbol("&GLOBAL_", var);
+	} else {
+		emit_addend_label("&", var, rel->addend);
+	}
+	out_char(' ');
+}
+
+// Number of zero bytes from pos, up to max, that can be written before
+// end or the next label inside the variable.
+int zero_run(Obj *var, int pos, int end, int max) {
+	int n = end - pos;
+	if (n > max) {
+		n = max;
+	}
+	int i;
+	for (i = 0; i < n; i += 1) {
+		if (i > 0 && var->reloc_targets && var->reloc_targets[pos + i]) {
+			return i;
+		}
+		if (var->init_data && var->init_data[pos + i] != 0) {
+			return i;
+		}
+	}
+	return n;
+}
+
+// Runs of zero bytes are written with the zero_256 and zero_16 fill
+// tokens defined in x86_defs.M1. Returns the number of bytes written by
+// a fill token at pos, or 0 if the run before end is too short.
+int emit_zero_fill(Obj *var, int pos, int end) {
+	int n = zero_run(var, pos, end, 256);
+	if (n == 256) {
+		end_data_run();
+		emit("zero_256");
+		return 256;
+	} else if (n >= 16) {
+		end_data_run();
+		emit("zero_16");
+		return 16;
+	}
+	return 0;
+}
+
 void emit_init_data(Obj *var) {
 	Relocation *rel = var->rel;
 	Relocation *new_rel;
 	int pos = 0;
-	// M1 does not properly support compile-time offsets/pointers, so
-	// we do it at runtime later.
+	int end;
+	int n;
 	while (pos < var->ty->size) {
+		emit_reloc_target(var, pos);
+		end = var->ty->size;
 		if (rel != NULL) {
 			if (rel->offset == pos) {
-				rel->id = reloc_id;
-				fputc('\n', output_file);
-				num_postfix(":REL_", reloc_id);
-				emit("%0");
-				reloc_id += 1;
 				new_rel = rel->next;
-				rel->next = relocations;
-				relocations = rel;
+				emit_reloc(rel);
 				rel = new_rel;
 				pos += 4;
 				continue;
 			}
+			end = rel->offset;
 		}
-		fputc('!', output_file);
-		fputs(uint2str(var->init_data[pos]), output_file);
-		fputc(' ', output_file);
+		n = emit_zero_fill(var, pos, end);
+		if (n != 0) {
+			pos += n;
+			continue;
+		}
+		emit_data_byte(var->init_data[pos]);
 		pos += 1;
 	}
+	end_data_run();
+}
+
+// Returns true if a variable is all zero bytes.
+int is_zero_data(Obj *var) {
+	if (var->init_data == NULL) {
+		return TRUE;
+	}
+	if (var->rel != NULL) {
+		return FALSE;
+	}
+	int i;
+	for (i = 0; i < var->ty->size; i += 1) {
+		if (var->init_data[i] != 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+void emit_zero_data(Obj *var) {
+	int pos = 0;
+	int n;
+	while (pos < var->ty->size) {
+		emit_reloc_target(var, pos);
+		n = emit_zero_fill(var, pos, var->ty->size);
+		if (n == 0) {
+			emit_data_byte(0);
+			n = 1;
+		}
+		pos += n;
+	}
+	end_data_run();
+}
+
+void emit_global_data(Obj *var) {
+	out_char('\n');
+	emit_symbol(":GLOBAL_", var);
+	out_char('\n');
+	if (is_zero_data(var)) {
+		emit_zero_data(var);
+	} else {
+		emit_init_data(var);
+	}
+	emit_reloc_target(var, var->ty->size);
 }
 
+// Zero-initialised variables are grouped after the others.
 void emit_data(Obj *prog) {
 	emit(":ELF_data");
+	mark_reloc_targets(prog);
 
 	Obj *var;
-	int zero_count;
-	int i;
 	for (var = prog; var; var = var->next) {
-		if (var->is_function) {
-			continue;
+		if (!var->is_function && !is_zero_data(var)) {
+			emit_global_data(var);
+		}
+	}
+	for (var = prog; var; var = var->next) {
+		if (!var->is_function && is_zero_data(var)) {
+			emit_global_data(var);
 		}
+	}
+	out_char('\n');
+}
 
-		fputc('\n', output_file);
-		fputs(":GLOBAL_", output_file);
-		if (var->is_static) {
-			fputs(uint2str(infile_id), output_file);
-			fputs("_", output_file);
+//
+// IR emitter
+//
+// Virtual registers are given a register from IR_NUM_REGS, or failing
+// that a stack slot, by a linear scan over their live ranges in layout
+// order. Instructions are emitted with %eax and %edx as scratch
+// registers. A virtual register is not given a register that an
+// instruction inside its live range clobbers.
+//
+
+#define IR_NUM_REGS 4
+#define IR_CLOBBER_ALL 15
+
+char **ir_regs;      // ebx, ecx, esi, edi
+int *vreg_reg;       // Index into ir_regs plus one, or 0
+int *vreg_slot;      // Frame offset of a spilled register, or 0
+int *vreg_def;       // Position of the first definition
+int *vreg_end;       // Position of the last use
+int ir_frame_size;
+
+void init_ir_regs(void) {
+	ir_regs = calloc(IR_NUM_REGS, sizeof(char*));
+	ir_regs[0] = "ebx";
+	ir_regs[1] = "ecx";
+	ir_regs[2] = "esi";
+	ir_regs[3] = "edi";
+}
+
+// Returns the set of registers in ir_regs an instruction clobbers, as a
+// bit mask.
+int ir_clobbers(IRInsn *insn) {
+	int op = insn->op;
+	if (op == IR_CALL || op == IR_COPY) {
+		return IR_CLOBBER_ALL;
+	} else if (op == IR_ZERO) {
+		return 2 + 8;
+	} else if (op == IR_SWITCH) {
+		return 1;
+	} else if ((op == IR_SHL || op == IR_SHR) && insn->b) {
+		return 2;
+	}
+	return 0;
+}
+
+void add_use(int v, int pos) {
+	if (v == 0) {
+		return;
+	}
+	if (vreg_def[v] == 0) {
+		vreg_def[v] = pos;
+	}
+	if (vreg_end[v] < pos) {
+		vreg_end[v] = pos;
+	}
+}
+
+// Compute the live range of each virtual register.
+int number_insns(IRFunc *ir) {
+	int nvregs = ir->nvregs + 1;
+	vreg_reg = arena_alloc(scratch_arena, nvregs * sizeof(int));
+	vreg_slot = arena_alloc(scratch_arena, nvregs * sizeof(int));
+	vreg_def = arena_alloc(scratch_arena, nvregs * sizeof(int));
+	vreg_end = arena_alloc(scratch_arena, nvregs * sizeof(int));
+
+	int pos = 1;
+	BasicBlock *bb;
+	IRInsn *insn;
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		bb->start = pos;
+		for (insn = bb->insns; insn; insn = insn->next) {
+			insn->pos = pos;
+			add_use(insn->a, pos);
+			add_use(insn->b, pos);
+			add_use(insn->dst, pos);
+			pos += 1;
+		}
+		bb->end = pos - 1;
+	}
+
+	// A value that is live at the head of a loop is live throughout it.
+	int changed = TRUE;
+	int i;
+	int v;
+	BasicBlock *head;
+	while (changed) {
+		changed = FALSE;
+		for (bb = ir->blocks; bb; bb = bb->next) {
+			for (i = 0; i < bb->nsuccs; i += 1) {
+				head = bb->succs[i];
+				if (head->start > bb->end) {
+					continue;
+				}
+				for (v = 1; v < nvregs; v += 1) {
+					if (vreg_def[v] < head->start && vreg_end[v] >= head->start &&
+							vreg_end[v] < bb->end) {
+						vreg_end[v] = bb->end;
+						changed = TRUE;
+					}
+				}
+			}
 		}
-		fputs(var->name, output_file);
-		fputc('\n', output_file);
-		if (var->init_data != NULL) {
-			emit_init_data(var);
+	}
+	return pos;
+}
+
+void allocate_vregs(IRFunc *ir) {
+	if (!ir_regs) {
+		init_ir_regs();
+	}
+	int npos = number_insns(ir);
+
+	// clobbered[pos * IR_NUM_REGS + r] counts the instructions up to pos
+	// clobbering register r.
+	int *clobbered = arena_alloc(scratch_arena, (npos + 1) * IR_NUM_REGS * sizeof(int));
+	BasicBlock *bb;
+	IRInsn *insn;
+	int mask;
+	int r;
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		for (insn = bb->insns; insn; insn = insn->next) {
+			mask = ir_clobbers(insn);
+			for (r = 0; r < IR_NUM_REGS; r += 1) {
+				clobbered[insn->pos * IR_NUM_REGS + r] = clobbered[(insn->pos - 1) * IR_NUM_REGS + r];
+				if (mask & (1 << r)) {
+					clobbered[insn->pos * IR_NUM_REGS + r] += 1;
+				}
+			}
+		}
+	}
+
+	ir_frame_size = ir->fn->stack_size;
+	int *reg_end = arena_alloc(scratch_arena, IR_NUM_REGS * sizeof(int));
+	int v;
+	int def;
+	int end;
+	int i;
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		for (insn = bb->insns; insn; insn = insn->next) {
+			v = insn->dst;
+			if (v == 0 || vreg_def[v] != insn->pos) {
+				continue;
+			}
+			def = vreg_def[v];
+			end = vreg_end[v];
+			if (end == def) {
+				// Never used
+				continue;
+			}
+
+			// Operands are read before an instruction clobbers anything or
+			// writes its result, so only the instructions strictly inside
+			// the live range count, and a register whose value is last used
+			// by the defining instruction is free. The register of the
+			// first operand is tried first.
+			for (i = -1; i < IR_NUM_REGS; i += 1) {
+				if (i == -1) {
+					r = vreg_reg[insn->a] - 1;
+				} else {
+					r = i;
+				}
+				if (r < 0 || reg_end[r] > def) {
+					continue;
+				}
+				if (clobbered[(end - 1) * IR_NUM_REGS + r] != clobbered[def * IR_NUM_REGS + r]) {
+					continue;
+				}
+				vreg_reg[v] = r + 1;
+				reg_end[r] = end;
+				break;
+			}
+
+			if (vreg_reg[v] == 0) {
+				ir_frame_size += 4;
+				vreg_slot[v] = -ir_frame_size;
+			}
+		}
+	}
+	ir_frame_size = align_to(ir_frame_size, 16);
+}
+
+// Returns the register holding a virtual register, or NULL.
+char *vreg_name(int v) {
+	if (vreg_reg[v] == 0) {
+		return NULL;
+	}
+	return ir_regs[vreg_reg[v] - 1];
+}
+
+// Returns the register a result is computed in: its own if it has one,
+// %eax otherwise.
+char *dst_reg(int v) {
+	if (v != 0 && vreg_reg[v] != 0) {
+		return ir_regs[vreg_reg[v] - 1];
+	}
+	return "eax";
+}
+
+// Copy a virtual register into a register.
+void ir_load(char *reg, int v) {
+	char *name = vreg_name(v);
+	if (name) {
+		if (strcmp(name, reg)) {
+			emit_rr("mov", reg, name);
+		}
+	} else if (vreg_slot[v] != 0) {
+		load_frame(ty_int, reg, vreg_slot[v]);
+	}
+}
+
+// Copy a register into a virtual register.
+void ir_store(int v, char *reg) {
+	char *name = vreg_name(v);
+	if (name) {
+		if (strcmp(name, reg)) {
+			emit_rr("mov", name, reg);
+		}
+	} else if (vreg_slot[v] != 0) {
+		out_str("mov_[ebp+DWORD],");
+		out_str(reg);
+		str_postfix(" %", int2str(vreg_slot[v], 10, TRUE));
+	}
+}
+
+// Returns "%imm", or "!imm" if `byte` is set.
+char *imm_operand(int32_t imm, int byte) {
+	if (byte) {
+		return label_name("!", uint2str(imm & 31));
+	}
+	return label_name("%", uint2str(imm));
+}
+
+void emit_ir_binary(IRInsn *insn) {
+	int op = insn->op;
+	char *dst = dst_reg(insn->dst);
+	char *insn_name;
+
+	if (op == IR_SHL || op == IR_SHR) {
+		if (op == IR_SHL) {
+			insn_name = "shl";
+		} else if (insn->is_unsigned) {
+			insn_name = "shr";
 		} else {
-			zero_count = var->ty->size;
-			for (zero_count; zero_count > 0; zero_count -= 1) {
-				fputs("!0 ", output_file);
+			insn_name = "sar";
+		}
+		if (insn->b) {
+			ir_load("eax", insn->a);
+			ir_load("ecx", insn->b);
+			out_str(insn_name);
+			emit("_eax,cl");
+			ir_store(insn->dst, "eax");
+			return;
+		}
+		ir_load(dst, insn->a);
+		emit_ri(insn_name, dst, imm_operand(insn->imm, TRUE));
+		ir_store(insn->dst, dst);
+		return;
+	}
+
+	if (op == IR_ADD) {
+		insn_name = "add";
+	} else if (op == IR_SUB) {
+		insn_name = "sub";
+	} else if (op == IR_MUL) {
+		insn_name = "imul";
+	} else if (op == IR_AND) {
+		insn_name = "and";
+	} else if (op == IR_OR) {
+		insn_name = "or";
+	} else {
+		insn_name = "xor";
+	}
+
+	// The left operand is moved into the result register first, which
+	// must not hold the right operand.
+	if (insn->b && vreg_reg[insn->b] != 0 && vreg_reg[insn->b] == vreg_reg[insn->dst]) {
+		dst = "eax";
+	}
+	ir_load(dst, insn->a);
+	if (!insn->b) {
+		emit_ri(insn_name, dst, imm_operand(insn->imm, FALSE));
+	} else if (vreg_name(insn->b)) {
+		emit_rr(insn_name, dst, vreg_name(insn->b));
+	} else {
+		ir_load("edx", insn->b);
+		emit_rr(insn_name, dst, "edx");
+	}
+	ir_store(insn->dst, dst);
+}
+
+void emit_ir_div(IRInsn *insn) {
+	ir_load("eax", insn->a);
+	char *div = "idiv_";
+	if (insn->is_unsigned) {
+		div = "div_";
+		emit("mov_edx, %0");
+	} else {
+		emit("cdq");
+	}
+
+	if (vreg_name(insn->b)) {
+		str_postfix(div, vreg_name(insn->b));
+	} else {
+		out_str(div);
+		str_postfix("DWORD_PTR_[ebp+DWORD] %", int2str(vreg_slot[insn->b], 10, TRUE));
+	}
+
+	if (insn->op == IR_MOD) {
+		ir_store(insn->dst, "edx");
+	} else {
+		ir_store(insn->dst, "eax");
+	}
+}
+
+// Compare a with b or imm, and return nothing; the flags hold the result.
+void emit_ir_compare(IRInsn *insn) {
+	char *lhs = vreg_name(insn->a);
+	if (!lhs) {
+		lhs = "eax";
+		ir_load("eax", insn->a);
+	}
+	if (!insn->b) {
+		emit_ri("cmp", lhs, imm_operand(insn->imm, FALSE));
+	} else if (vreg_name(insn->b)) {
+		emit_rr("cmp", lhs, vreg_name(insn->b));
+	} else {
+		ir_load("edx", insn->b);
+		emit_rr("cmp", lhs, "edx");
+	}
+}
+
+// Compute the address of a variable plus an offset into a register.
+void emit_var_addr(char *reg, Obj *var, int offset) {
+	if (var->is_local) {
+		out_str("lea_");
+		out_str(reg);
+		str_postfix(",[ebp+DWORD] %", int2str(var->offset + offset, 10, TRUE));
+		return;
+	}
+	emit_global_addr(reg, var);
+	if (offset != 0) {
+		emit_ri("add", reg, imm_operand(offset, FALSE));
+	}
+}
+
+void emit_ir_load(IRInsn *insn) {
+	char *dst = dst_reg(insn->dst);
+	if (insn->var && insn->var->is_local) {
+		load_frame(insn->ty, dst, insn->var->offset + insn->imm);
+	} else {
+		if (insn->var) {
+			emit_var_addr(dst, insn->var, insn->imm);
+		} else {
+			ir_load(dst, insn->a);
+			if (insn->imm != 0) {
+				emit_ri("add", dst, imm_operand(insn->imm, FALSE));
 			}
 		}
+		load_reg(insn->ty, dst);
+	}
+	ir_store(insn->dst, dst);
+}
+
+void emit_ir_store(IRInsn *insn) {
+	char *src;
+	if (insn->ty->size == 4 && vreg_name(insn->b)) {
+		src = vreg_name(insn->b);
+	} else {
+		ir_load("eax", insn->b);
+		if (insn->ty->size == 1) {
+			src = "al";
+		} else if (insn->ty->size == 2) {
+			src = "ax";
+		} else {
+			src = "eax";
+		}
+	}
+
+	if (insn->var && insn->var->is_local) {
+		out_str("mov_[ebp+DWORD],");
+		out_str(src);
+		str_postfix(" %", int2str(insn->var->offset + insn->imm, 10, TRUE));
+		return;
+	}
+
+	if (insn->var) {
+		emit_var_addr("edx", insn->var, insn->imm);
+	} else {
+		ir_load("edx", insn->a);
+		if (insn->imm != 0) {
+			emit_ri("add", "edx", imm_operand(insn->imm, FALSE));
+		}
+	}
+	str_postfix("mov_[edx],", src);
+}
+
+void emit_ir_insn(IRInsn *insn, BasicBlock *bb) {
+	int op = insn->op;
+	char *dst;
+
+	if (op == IR_NOP) {
+		return;
+	} else if (op == IR_IMM) {
+		dst = dst_reg(insn->dst);
+		emit_ri("mov", dst, imm_operand(insn->imm, FALSE));
+		ir_store(insn->dst, dst);
+	} else if (op == IR_MOV) {
+		dst = dst_reg(insn->dst);
+		ir_load(dst, insn->a);
+		ir_store(insn->dst, dst);
+	} else if (op == IR_ADDR) {
+		dst = dst_reg(insn->dst);
+		emit_var_addr(dst, insn->var, insn->imm);
+		ir_store(insn->dst, dst);
+	} else if (op == IR_LOAD) {
+		emit_ir_load(insn);
+	} else if (op == IR_STORE) {
+		emit_ir_store(insn);
+	} else if (op == IR_COPY) {
+		ir_load("eax", insn->b);
+		ir_load("ebx", insn->a);
+		copy_struct(insn->imm);
+	} else if (op == IR_ZERO) {
+		gen_memzero(insn->var->offset, insn->var->ty->size);
+	} else if (op == IR_DIV || op == IR_MOD) {
+		emit_ir_div(insn);
+	} else if (op == IR_ADD || op == IR_SUB || op == IR_MUL || op == IR_AND ||
+			op == IR_OR || op == IR_XOR || op == IR_SHL || op == IR_SHR) {
+		emit_ir_binary(insn);
+	} else if (op == IR_CMP) {
+		emit_ir_compare(insn);
+		emit(compare_set(insn->cond, insn->is_unsigned));
+		emit("movzx_eax,al");
+		ir_store(insn->dst, "eax");
+	} else if (op == IR_NEG || op == IR_NOT) {
+		dst = dst_reg(insn->dst);
+		ir_load(dst, insn->a);
+		if (op == IR_NEG) {
+			emit_r("neg", dst);
+		} else {
+			emit_r("not", dst);
+		}
+		ir_store(insn->dst, dst);
+	} else if (op == IR_CAST) {
+		dst = dst_reg(insn->dst);
+		ir_load(dst, insn->a);
+		gen_reg_cast(insn->imm, dst);
+		ir_store(insn->dst, dst);
+	} else if (op == IR_ARG) {
+		if (vreg_name(insn->a)) {
+			emit_r("push", vreg_name(insn->a));
+		} else {
+			ir_load("eax", insn->a);
+			emit("push_eax");
+		}
+		depth += 1;
+	} else if (op == IR_CALL) {
+		emit_call(insn->name);
+		if (insn->imm != 0) {
+			num_postfix("add_esp, %", insn->imm * 4);
+		}
+		depth -= insn->imm;
+		fix_return_value(insn->ty);
+		ir_store(insn->dst, "eax");
+	} else if (op == IR_JMP) {
+		if (bb->succs[0] != bb->next) {
+			emit_jump("jmp", bb->succs[0]->label);
+		}
+	} else if (op == IR_BR) {
+		emit_ir_compare(insn);
+		BasicBlock *then = bb->succs[0];
+		BasicBlock *els = bb->succs[1];
+		if (els == bb->next) {
+			emit_jump(compare_jump(insn->cond, insn->is_unsigned, FALSE), then->label);
+		} else if (then == bb->next) {
+			emit_jump(compare_jump(insn->cond, insn->is_unsigned, TRUE), els->label);
+		} else {
+			emit_jump(compare_jump(insn->cond, insn->is_unsigned, FALSE), then->label);
+			emit_jump("jmp", els->label);
+		}
+	} else if (op == IR_SWITCH) {
+		ir_load("eax", insn->a);
+		gen_switch(insn->node);
+	} else if (op == IR_RET) {
+		if (insn->a) {
+			ir_load("eax", insn->a);
+		}
+		if (bb->next) {
+			str_postfix("jmp %BUILTIN_return_", codegening_fn->name);
+		}
+	} else {
+		error("invalid IR instruction");
+	}
+}
+
+void emit_ir(IRFunc *ir) {
+	BasicBlock *bb;
+	IRInsn *insn;
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		str_postfix(":", bb->label);
+		for (insn = bb->insns; insn; insn = insn->next) {
+			emit_ir_insn(insn, bb);
+		}
+	}
+}
+
+// Emit the label of a function, and for main the setup of global
+// variable addends.
+void emit_function_start(Obj *fn) {
+	out_str(":FUNCTION_");
+	if (fn->is_static) {
+		out_str(uint2str(infile_id));
+		out_str("_");
+	}
+	out_str(fn->name);
+	out_char('\n');
+
+	// Global variable addend setup
+	if (strcmp(fn->name, "main")) {
+		return;
+	}
+	Relocation *rel;
+	for (rel = relocations; rel != NULL; rel = rel->next) {
+		if (rel->var->is_function) {
+			emit_symbol("mov_eax, &FUNCTION_", rel->var);
+		} else {
+			emit_symbol("mov_eax, &GLOBAL_", rel->var);
+		}
+		out_char('\n');
+		if (rel->addend > 0) {
+			num_postfix("add_eax, %", rel->addend);
+		} else {
+			emit("mov_ebx,eax");
+			num_postfix("mov_eax, %", -(rel->addend));
+			emit("sub_ebx,eax");
+			emit("mov_eax,ebx");
+		}
+		num_postfix("mov_ebx, &REL_", rel->id);
+		emit("mov_[ebx],eax");
+	}
+}
+
+void emit_prologue(Obj *fn, int stack_size) {
+	emit("push_ebp");
+	emit("mov_ebp,esp");
+	expand_stack(stack_size);
+
+	// Save arguments to the stack.
+	// They are already on the stack, but not at the offset we expect them
+	// to be at.
+	// We start at i = 2 because two things have been pushed onto the stack;
+	// 1. return address by call
+	// 2. push_ebp above
+	int i = 2;
+	Obj *var;
+	for (var = fn->params; var; var = var->next) {
+		num_postfix("lea_eax,[ebp+DWORD] %", i * 4);
+		emit("mov_edx,eax");
+		str_postfix("lea_eax,[ebp+DWORD] %", int2str(var->offset, 10, TRUE));
+		emit("mov_ebx,eax");
+		emit("mov_eax,edx");
+		emit("mov_eax,[eax]");
+		mov_with_size(var->ty);
+		i += 1;
 	}
-	fputc('\n', output_file);
 }
 
 void emit_text(Obj *prog) {
 	emit(":ELF_text");
 
 	Obj *fn;
-	int i;
-	Obj *var;
-	Relocation *rel;
+	IRFunc *ir;
 	for (fn = prog; fn; fn = fn->next) {
 		if (!fn->is_function || !fn->is_definition) {
 			continue;
 		}
 
 		codegening_fn = fn;
-		fputs(":FUNCTION_", output_file);
-		if (fn->is_static) {
-			fputs(uint2str(infile_id), output_file);
-			fputs("_", output_file);
-		}
-		fputs(fn->name, output_file);
-		fputc('\n', output_file);
-
-		// Global variable addend setup
-		if (!strcmp(fn->name, "main")) {
-			for (rel = relocations; rel != NULL; rel = rel->next) {
-				// TODO I am a bit indecisive about whether to initially store
-				// 0s at REL_blah or GLOBAL_.
-				// TODO simplify
-				fputs("mov_eax, &GLOBAL_", output_file);
-				if (rel->var->is_static) {
-					fputs(uint2str(infile_id), output_file);
-					fputs("_", output_file);
-				}
-				fputs(rel->var->name, output_file);
-				fputc('\n', output_file);
-				if (rel->addend > 0) {
-					num_postfix("add_eax, %", rel->addend);
-				} else {
-					emit("mov_ebx,eax");
-					num_postfix("mov_eax, %", -(rel->addend));
-					emit("sub_ebx,eax");
-					emit("mov_eax,ebx");
-				}
-				num_postfix("mov_ebx, &REL_", rel->id);
-				emit("mov_[ebx],eax");
-			}
-		}
+		buffering = TRUE;
+		emit_function_start(fn);
 
-		// Prologue
-		emit("push_ebp");
-		emit("mov_ebp,esp");
-		expand_stack(fn->stack_size);
-
-		// Save arguments to the stack.
-		// They are already on the stack, but not at the offset we expect them
-		// to be at.
-		// We start at i = 2 because two things have been pushed onto the stack;
-		// 1. return address by call
-		// 2. push_ebp above
-		i = 2;
-		for (var = fn->params; var; var = var->next) {
-			num_postfix("lea_eax,[ebp+DWORD] %", i * 4);
-			emit("mov_edx,eax");
-			str_postfix("lea_eax,[ebp+DWORD] %", int2str(var->offset, 10, TRUE));
-			emit("mov_ebx,eax");
-			emit("mov_eax,edx");
-			emit("mov_eax,[eax]");
-			mov_with_size(var->ty);
-			i += 1;
+		if (opt_fir) {
+			ir = lower_function(fn);
+			allocate_vregs(ir);
+			emit_prologue(fn, ir_frame_size);
+			emit_ir(ir);
+		} else {
+			emit_prologue(fn, fn->stack_size);
+			gen_stmt(fn->body);
 		}
-
-		// Emit code
-		gen_stmt(fn->body);
 		if (depth != 0) {
 			error("depth not 0 at end of function");
 		}
@@ -766,16 +2186,58 @@ void emit_text(Obj *prog) {
 		emit("mov_esp,ebp");
 		emit("pop_ebp");
 		emit("ret");
+
+		buffering = FALSE;
+		peephole_flush(output_file);
+		arena_reset(scratch_arena);
+	}
+}
+
+// Jump tables hold absolute label addresses, which hex2 fills in.
+void emit_jump_tables(void) {
+	JumpTable *table;
+	Node **cases;
+	int32_t val;
+	int32_t last;
+	int i;
+	for (table = jump_tables; table; table = table->next) {
+		cases = table->cases;
+		out_char('\n');
+		num_postfix(":SWITCH_table_", table->id);
+		// One entry for each value from the first case to the last
+		val = cases[0]->val;
+		last = cases[table->ncases - 1]->val;
+		i = 0;
+		while (TRUE) {
+			if (i < table->ncases && cases[i]->val == val) {
+				str_postfix("&LABEL_", cases[i]->label);
+				i += 1;
+			} else {
+				str_postfix("&", table->default_label);
+			}
+			if (val == last) {
+				break;
+			}
+			val += 1;
+		}
 	}
+	jump_tables = NULL;
 }
 
 void codegen(Obj *prog, FILE *out) {
 	output_file = out;
+	if (!line_buf) {
+		line_buf = calloc(MAX_STRING, sizeof(char));
+	}
 
 	functions = prog;
+	if (!reg_order) {
+		init_reg_order();
+	}
 	assign_lvar_offsets(prog);
 	emit_data(prog);
 	emit_text(prog);
+	emit_jump_tables();
 
 	infile_id += 1;
 }
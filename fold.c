@@ -0,0 +1,295 @@
+#include "chibicc.h"
+
+// Constant folding and algebraic simplification of function bodies,
+// run between parsing and code generation. Nodes are rewritten in place,
+// so lists of statements and arguments and the case lists of switches
+// stay linked. Constant subexpressions are computed with eval(), the
+// same evaluator used for constant expressions in the parser.
+
+void fold_node(Node *node);
+
+int is_scalar(Type *ty) {
+	if (ty == NULL) {
+		return FALSE;
+	}
+	if (ty->kind == TY_PTR) {
+		return TRUE;
+	}
+	return is_integer(ty);
+}
+
+int is_num(Node *node, int32_t val) {
+	return node->kind == ND_NUM && node->val == val;
+}
+
+// Returns true if a node contains a label or case that may be jumped to
+// from outside of it, so it cannot be removed.
+int has_label(Node *node) {
+	if (node == NULL) {
+		return FALSE;
+	}
+	if (node->kind == ND_LABEL || node->kind == ND_CASE) {
+		return TRUE;
+	}
+	if (has_label(node->lhs) || has_label(node->rhs)) {
+		return TRUE;
+	}
+	if (has_label(node->cond) || has_label(node->then) || has_label(node->els)) {
+		return TRUE;
+	}
+	if (has_label(node->init) || has_label(node->inc)) {
+		return TRUE;
+	}
+	Node *n;
+	for (n = node->body; n; n = n->next) {
+		if (has_label(n)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// Returns true if evaluating a node has no side effects.
+int has_no_effect(Node *node) {
+	int kind = node->kind;
+	if (kind == ND_NUM || kind == ND_VAR) {
+		return TRUE;
+	}
+	if (kind == ND_MEMBER || kind == ND_CAST || kind == ND_NEG ||
+	    kind == ND_NOT || kind == ND_BITNOT || kind == ND_ADDR) {
+		return has_no_effect(node->lhs);
+	}
+	if (kind == ND_ADD || kind == ND_SUB || kind == ND_MUL ||
+	    kind == ND_BITAND || kind == ND_BITOR || kind == ND_BITXOR ||
+	    kind == ND_EQ || kind == ND_NE || kind == ND_LT || kind == ND_LE) {
+		return has_no_effect(node->lhs) && has_no_effect(node->rhs);
+	}
+	return FALSE;
+}
+
+int is_foldable(Node *node) {
+	int kind = node->kind;
+	if (kind == ND_NEG || kind == ND_NOT || kind == ND_BITNOT || kind == ND_CAST) {
+		return node->lhs->kind == ND_NUM && is_scalar(node->lhs->ty);
+	}
+	if (kind == ND_DIV || kind == ND_MOD) {
+		// Leave traps to run time
+		if (node->rhs->kind != ND_NUM || node->rhs->val == 0 || node->rhs->val == -1) {
+			return FALSE;
+		}
+	} else if (kind == ND_SHL || kind == ND_SHR) {
+		if (node->rhs->kind != ND_NUM || node->rhs->val < 0 || node->rhs->val > 31) {
+			return FALSE;
+		}
+	} else if (!(kind == ND_ADD || kind == ND_SUB || kind == ND_MUL ||
+	             kind == ND_BITAND || kind == ND_BITOR || kind == ND_BITXOR ||
+	             kind == ND_EQ || kind == ND_NE || kind == ND_LT || kind == ND_LE ||
+	             kind == ND_LOGAND || kind == ND_LOGOR)) {
+		return FALSE;
+	}
+	return node->lhs->kind == ND_NUM && node->rhs->kind == ND_NUM;
+}
+
+void set_num(Node *node, int32_t val) {
+	node->kind = ND_NUM;
+	node->val = val;
+	node->lhs = NULL;
+	node->rhs = NULL;
+}
+
+int same_type(Type *a, Type *b) {
+	if (a == b) {
+		return TRUE;
+	}
+	if (a->kind == TY_PTR && b->kind == TY_PTR) {
+		return TRUE;
+	}
+	return a->kind == b->kind && a->size == b->size && a->is_unsigned == b->is_unsigned;
+}
+
+// Replace node with expr, keeping the type of node.
+void replace_expr(Node *node, Node *expr) {
+	if (!is_scalar(expr->ty)) {
+		return;
+	}
+	if (!same_type(node->ty, expr->ty)) {
+		node->kind = ND_CAST;
+		node->lhs = expr;
+		node->rhs = NULL;
+		return;
+	}
+	Node *next = node->next;
+	Type *ty = node->ty;
+	memcpy(node, expr, sizeof(Node));
+	node->next = next;
+	node->ty = ty;
+}
+
+// Replace a statement with a block of the given statement, or an empty
+// block if stmt is NULL.
+void replace_stmt(Node *node, Node *stmt) {
+	node->kind = ND_BLOCK;
+	node->body = stmt;
+	node->cond = NULL;
+	node->then = NULL;
+	node->els = NULL;
+	node->init = NULL;
+	node->inc = NULL;
+}
+
+// x+0, x*1, x*0 and the like
+void simplify(Node *node) {
+	int kind = node->kind;
+	Node *lhs = node->lhs;
+	Node *rhs = node->rhs;
+	if (kind == ND_ADD || kind == ND_BITOR || kind == ND_BITXOR) {
+		if (is_num(rhs, 0)) {
+			replace_expr(node, lhs);
+		} else if (is_num(lhs, 0)) {
+			replace_expr(node, rhs);
+		}
+	} else if (kind == ND_SUB || kind == ND_SHL || kind == ND_SHR) {
+		if (is_num(rhs, 0)) {
+			replace_expr(node, lhs);
+		}
+	} else if (kind == ND_MUL) {
+		if (is_num(rhs, 1)) {
+			replace_expr(node, lhs);
+		} else if (is_num(lhs, 1)) {
+			replace_expr(node, rhs);
+		} else if (is_num(rhs, 0) && has_no_effect(lhs)) {
+			set_num(node, 0);
+		} else if (is_num(lhs, 0) && has_no_effect(rhs)) {
+			set_num(node, 0);
+		}
+	} else if (kind == ND_DIV) {
+		if (is_num(rhs, 1)) {
+			replace_expr(node, lhs);
+		}
+	} else if (kind == ND_BITAND) {
+		if (is_num(rhs, 0) && has_no_effect(lhs)) {
+			set_num(node, 0);
+		} else if (is_num(lhs, 0) && has_no_effect(rhs)) {
+			set_num(node, 0);
+		}
+	} else if (kind == ND_LOGAND) {
+		if (is_num(lhs, 0) && !has_label(rhs)) {
+			set_num(node, 0);
+		}
+	} else if (kind == ND_LOGOR) {
+		if (lhs->kind == ND_NUM && lhs->val != 0 && !has_label(rhs)) {
+			set_num(node, 1);
+		}
+	} else if (kind == ND_COMMA) {
+		if (has_no_effect(lhs)) {
+			replace_expr(node, rhs);
+		}
+	}
+}
+
+// (x+c1)+c2 to x+(c1+c2), and likewise for *. Integer arithmetic wraps
+// around, so this gives the same result.
+void reassociate(Node *node) {
+	int kind = node->kind;
+	Node *lhs = node->lhs;
+	if (kind != ND_ADD && kind != ND_MUL) {
+		return;
+	}
+	// The usual arithmetic conversions cast the operands even when their
+	// type does not change.
+	while (lhs->kind == ND_CAST && same_type(lhs->ty, lhs->lhs->ty)) {
+		lhs = lhs->lhs;
+	}
+	if (lhs->kind != kind || lhs->rhs->kind != ND_NUM || node->rhs->kind != ND_NUM) {
+		return;
+	}
+	if (!is_integer(node->ty) || !same_type(node->ty, lhs->ty)) {
+		return;
+	}
+	if (kind == ND_ADD) {
+		node->rhs->val = lhs->rhs->val + node->rhs->val;
+	} else {
+		node->rhs->val = lhs->rhs->val * node->rhs->val;
+	}
+	node->lhs = lhs->lhs;
+}
+
+void fold_list(Node *node) {
+	for (node; node; node = node->next) {
+		fold_node(node);
+	}
+}
+
+void fold_node(Node *node) {
+	if (node == NULL) {
+		return;
+	}
+
+	fold_node(node->lhs);
+	fold_node(node->rhs);
+	fold_node(node->cond);
+	fold_node(node->then);
+	fold_node(node->els);
+	fold_node(node->init);
+	fold_node(node->inc);
+	fold_list(node->body);
+	fold_list(node->args);
+
+	int kind = node->kind;
+	if (kind == ND_IF) {
+		if (node->cond->kind != ND_NUM) {
+			return;
+		}
+		if (node->cond->val) {
+			if (!has_label(node->els)) {
+				replace_stmt(node, node->then);
+			}
+		} else if (!has_label(node->then)) {
+			replace_stmt(node, node->els);
+		}
+		return;
+	} else if (kind == ND_FOR) {
+		if (node->cond == NULL || node->cond->kind != ND_NUM) {
+			return;
+		}
+		if (node->cond->val) {
+			node->cond = NULL;
+		} else if (!has_label(node->then) && !has_label(node->inc)) {
+			replace_stmt(node, node->init);
+		}
+		return;
+	} else if (kind == ND_COND) {
+		if (node->cond->kind != ND_NUM) {
+			return;
+		}
+		if (node->cond->val) {
+			if (!has_label(node->els)) {
+				replace_expr(node, node->then);
+			}
+		} else if (!has_label(node->then)) {
+			replace_expr(node, node->els);
+		}
+		return;
+	}
+
+	if (!is_scalar(node->ty)) {
+		return;
+	}
+	if (is_foldable(node)) {
+		set_num(node, eval(node));
+		return;
+	}
+	if (node->lhs && node->rhs) {
+		reassociate(node);
+		simplify(node);
+	}
+}
+
+void fold_constants(Obj *prog) {
+	Obj *fn;
+	for (fn = prog; fn; fn = fn->next) {
+		if (fn->is_function && fn->is_definition) {
+			fold_node(fn->body);
+		}
+	}
+}
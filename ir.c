@@ -0,0 +1,670 @@
+#include "chibicc.h"
+
+// Lowering of a function's AST into a linear three-address IR. Every
+// expression leaves its value in a new virtual register, and control flow
+// is made explicit with basic blocks that end in a jump, branch, switch or
+// return. The IR of a function lives in the scratch arena until it has
+// been emitted.
+
+IRFunc *ir_fn;
+BasicBlock *cur_block;
+BasicBlock *last_block;
+
+// Block starting at a C label, a case or a break/continue target.
+struct LabelBlock {
+	struct LabelBlock *next;
+	char *label;
+	BasicBlock *block;
+};
+typedef struct LabelBlock LabelBlock;
+
+LabelBlock *label_blocks;
+
+int lower_expr(Node *node);
+void lower_stmt(Node *node);
+
+int new_vreg(void) {
+	ir_fn->nvregs += 1;
+	return ir_fn->nvregs;
+}
+
+BasicBlock *new_block(void) {
+	BasicBlock *bb = arena_alloc(scratch_arena, sizeof(BasicBlock));
+	bb->label = label_name("BLOCK_", uint2str(count()));
+	return bb;
+}
+
+// Returns the block starting at a given label, creating it on first use.
+BasicBlock *label_block(char *label) {
+	LabelBlock *lb;
+	for (lb = label_blocks; lb; lb = lb->next) {
+		if (!strcmp(lb->label, label)) {
+			return lb->block;
+		}
+	}
+
+	lb = arena_alloc(scratch_arena, sizeof(LabelBlock));
+	lb->label = label;
+	lb->block = new_block();
+	lb->block->label = label_name("LABEL_", label);
+	lb->next = label_blocks;
+	label_blocks = lb;
+	return lb->block;
+}
+
+int is_terminator(int op) {
+	return op == IR_JMP || op == IR_BR || op == IR_SWITCH || op == IR_RET;
+}
+
+int is_terminated(BasicBlock *bb) {
+	if (!bb->last) {
+		return FALSE;
+	}
+	return is_terminator(bb->last->op);
+}
+
+void append_insn(BasicBlock *bb, IRInsn *insn) {
+	if (bb->last) {
+		bb->last->next = insn;
+	} else {
+		bb->insns = insn;
+	}
+	bb->last = insn;
+}
+
+void set_succs(BasicBlock *bb, int nsuccs) {
+	bb->succs = arena_alloc(scratch_arena, nsuccs * sizeof(BasicBlock*));
+	bb->nsuccs = nsuccs;
+}
+
+void start_block(BasicBlock *bb);
+
+// Append an instruction to the current block. Code following a jump
+// goes into a new block, which has no predecessors unless it is given a
+// label later on.
+IRInsn *new_insn(int op) {
+	if (is_terminated(cur_block)) {
+		start_block(new_block());
+	}
+	IRInsn *insn = arena_alloc(scratch_arena, sizeof(IRInsn));
+	insn->op = op;
+	append_insn(cur_block, insn);
+	return insn;
+}
+
+void jump_to(BasicBlock *bb) {
+	new_insn(IR_JMP);
+	set_succs(cur_block, 1);
+	cur_block->succs[0] = bb;
+}
+
+// Make a given block the current one, falling through into it from the
+// previous one.
+void start_block(BasicBlock *bb) {
+	if (cur_block && !is_terminated(cur_block)) {
+		jump_to(bb);
+	}
+	if (last_block) {
+		last_block->next = bb;
+	} else {
+		ir_fn->blocks = bb;
+	}
+	last_block = bb;
+	cur_block = bb;
+}
+
+// Branch to `then` if `a cond b` holds and to `els` otherwise. If b is 0,
+// imm is compared against instead.
+void branch(int cond, int is_unsigned, int a, int b, int imm, BasicBlock *then, BasicBlock *els) {
+	IRInsn *insn = new_insn(IR_BR);
+	insn->cond = cond;
+	insn->is_unsigned = is_unsigned;
+	insn->a = a;
+	insn->b = b;
+	insn->imm = imm;
+	set_succs(cur_block, 2);
+	cur_block->succs[0] = then;
+	cur_block->succs[1] = els;
+}
+
+int emit_imm(int val) {
+	IRInsn *insn = new_insn(IR_IMM);
+	insn->dst = new_vreg();
+	insn->imm = val;
+	return insn->dst;
+}
+
+int emit_unary(int op, int a) {
+	IRInsn *insn = new_insn(op);
+	insn->dst = new_vreg();
+	insn->a = a;
+	return insn->dst;
+}
+
+int emit_binary(int op, int a, int b, int imm) {
+	IRInsn *insn = new_insn(op);
+	insn->dst = new_vreg();
+	insn->a = a;
+	insn->b = b;
+	insn->imm = imm;
+	return insn->dst;
+}
+
+void emit_mov(int dst, int a) {
+	// If a was just computed, compute it into dst instead.
+	IRInsn *last = cur_block->last;
+	if (last && last->dst == a && last->op != IR_MOV) {
+		last->dst = dst;
+		return;
+	}
+
+	IRInsn *insn = new_insn(IR_MOV);
+	insn->dst = dst;
+	insn->a = a;
+}
+
+// Returns the instruction loading an immediate into v if it is the last
+// one emitted, so that its value can be used as an operand directly.
+IRInsn *last_imm(int v) {
+	IRInsn *last = cur_block->last;
+	if (last && last->op == IR_IMM && last->dst == v) {
+		return last;
+	}
+	return NULL;
+}
+
+//
+// Addresses
+//
+
+// An address is a variable or a base register, plus a constant offset.
+// It is returned in an IRInsn that is not part of any block, whose var,
+// a and imm fields are copied into loads and stores.
+IRInsn *lower_addr(Node *node) {
+	IRInsn *addr;
+	if (node->kind == ND_VAR) {
+		addr = arena_alloc(scratch_arena, sizeof(IRInsn));
+		addr->var = node->var;
+		return addr;
+	} else if (node->kind == ND_DEREF) {
+		addr = arena_alloc(scratch_arena, sizeof(IRInsn));
+		addr->a = lower_expr(node->lhs);
+		return addr;
+	} else if (node->kind == ND_MEMBER) {
+		addr = lower_addr(node->lhs);
+		addr->imm += node->member->offset;
+		return addr;
+	} else if (node->kind == ND_COMMA) {
+		lower_expr(node->lhs);
+		return lower_addr(node->rhs);
+	}
+
+	error_tok(node->tok, "not an lvalue");
+}
+
+// Compute an address into a register.
+int materialize_addr(IRInsn *addr) {
+	if (addr->var) {
+		IRInsn *insn = new_insn(IR_ADDR);
+		insn->dst = new_vreg();
+		insn->var = addr->var;
+		insn->imm = addr->imm;
+		return insn->dst;
+	}
+	if (addr->imm == 0) {
+		return addr->a;
+	}
+	return emit_binary(IR_ADD, addr->a, 0, addr->imm);
+}
+
+int is_aggregate(Type *ty) {
+	return ty->kind == TY_ARRAY || ty->kind == TY_STRUCT || ty->kind == TY_UNION;
+}
+
+// Load the value of an lvalue. Arrays, structs and unions evaluate to
+// their address.
+int lower_load(Node *node) {
+	IRInsn *addr = lower_addr(node);
+	if (is_aggregate(node->ty)) {
+		return materialize_addr(addr);
+	}
+
+	IRInsn *insn = new_insn(IR_LOAD);
+	insn->dst = new_vreg();
+	insn->var = addr->var;
+	insn->a = addr->a;
+	insn->imm = addr->imm;
+	insn->ty = node->ty;
+	return insn->dst;
+}
+
+int lower_assign(Node *node) {
+	IRInsn *addr = lower_addr(node->lhs);
+	IRInsn *insn;
+	int val;
+
+	if (node->ty->kind == TY_STRUCT || node->ty->kind == TY_UNION) {
+		int dst = materialize_addr(addr);
+		val = lower_expr(node->rhs);
+		insn = new_insn(IR_COPY);
+		insn->a = dst;
+		insn->b = val;
+		insn->imm = node->ty->size;
+		return dst;
+	}
+
+	val = lower_expr(node->rhs);
+	insn = new_insn(IR_STORE);
+	insn->var = addr->var;
+	insn->a = addr->a;
+	insn->b = val;
+	insn->imm = addr->imm;
+	insn->ty = node->ty;
+	return val;
+}
+
+//
+// Conditions
+//
+
+int is_compare(int kind) {
+	return kind == ND_EQ || kind == ND_NE || kind == ND_LT || kind == ND_LE;
+}
+
+// Branch to `then` if `node` is true and to `els` otherwise. Logical
+// operators become branches rather than 0/1 values.
+void lower_cond(Node *node, BasicBlock *then, BasicBlock *els) {
+	if (node->kind == ND_NUM) {
+		if (node->val != 0) {
+			jump_to(then);
+		} else {
+			jump_to(els);
+		}
+		return;
+	}
+
+	if (node->kind == ND_NOT) {
+		lower_cond(node->lhs, els, then);
+		return;
+	}
+
+	BasicBlock *rhs;
+	if (node->kind == ND_LOGAND) {
+		rhs = new_block();
+		lower_cond(node->lhs, rhs, els);
+		start_block(rhs);
+		lower_cond(node->rhs, then, els);
+		return;
+	}
+
+	if (node->kind == ND_LOGOR) {
+		rhs = new_block();
+		lower_cond(node->lhs, then, rhs);
+		start_block(rhs);
+		lower_cond(node->rhs, then, els);
+		return;
+	}
+
+	int a;
+	int b;
+	IRInsn *imm;
+	if (is_compare(node->kind)) {
+		a = lower_expr(node->lhs);
+		b = lower_expr(node->rhs);
+		imm = last_imm(b);
+		if (imm) {
+			branch(node->kind, node->lhs->ty->is_unsigned, a, 0, imm->imm, then, els);
+		} else {
+			branch(node->kind, node->lhs->ty->is_unsigned, a, b, 0, then, els);
+		}
+		return;
+	}
+
+	a = lower_expr(node);
+	branch(ND_NE, FALSE, a, 0, 0, then, els);
+}
+
+//
+// Expressions
+//
+
+// Returns the IR opcode of a binary operator.
+int binary_op(int kind) {
+	if (kind == ND_ADD) {
+		return IR_ADD;
+	} else if (kind == ND_SUB) {
+		return IR_SUB;
+	} else if (kind == ND_MUL) {
+		return IR_MUL;
+	} else if (kind == ND_DIV) {
+		return IR_DIV;
+	} else if (kind == ND_MOD) {
+		return IR_MOD;
+	} else if (kind == ND_BITAND) {
+		return IR_AND;
+	} else if (kind == ND_BITOR) {
+		return IR_OR;
+	} else if (kind == ND_BITXOR) {
+		return IR_XOR;
+	} else if (kind == ND_SHL) {
+		return IR_SHL;
+	} else if (kind == ND_SHR) {
+		return IR_SHR;
+	}
+	return IR_CMP;
+}
+
+int lower_funcall(Node *node) {
+	// Arguments are pushed right to left, each as soon as it has been
+	// computed, so that none is kept in a register across a call.
+	int nargs = 0;
+	Node *arg;
+	for (arg = node->args; arg; arg = arg->next) {
+		nargs += 1;
+	}
+
+	int i;
+	int j;
+	int val;
+	IRInsn *insn;
+	for (i = nargs - 1; i >= 0; i -= 1) {
+		arg = node->args;
+		for (j = 0; j < i; j += 1) {
+			arg = arg->next;
+		}
+		val = lower_expr(arg);
+		insn = new_insn(IR_ARG);
+		insn->a = val;
+	}
+
+	insn = new_insn(IR_CALL);
+	insn->dst = new_vreg();
+	insn->name = node->funcname;
+	insn->imm = nargs;
+	insn->ty = node->ty;
+	return insn->dst;
+}
+
+int lower_expr(Node *node) {
+	int kind = node->kind;
+	int dst;
+	int a;
+	BasicBlock *then;
+	BasicBlock *els;
+	BasicBlock *end;
+	IRInsn *insn;
+
+	if (kind == ND_NULL_EXPR) {
+		return emit_imm(0);
+	} else if (kind == ND_NUM) {
+		return emit_imm(node->val);
+	} else if (kind == ND_VAR || kind == ND_MEMBER || kind == ND_DEREF) {
+		return lower_load(node);
+	} else if (kind == ND_ADDR) {
+		return materialize_addr(lower_addr(node->lhs));
+	} else if (kind == ND_ASSIGN) {
+		return lower_assign(node);
+	} else if (kind == ND_STMT_EXPR) {
+		// The value is that of the last expression statement.
+		Node *n;
+		for (n = node->body; n; n = n->next) {
+			if (!n->next && n->kind == ND_EXPR_STMT) {
+				return lower_expr(n->lhs);
+			}
+			lower_stmt(n);
+		}
+		return emit_imm(0);
+	} else if (kind == ND_COMMA) {
+		lower_expr(node->lhs);
+		return lower_expr(node->rhs);
+	} else if (kind == ND_CAST) {
+		a = lower_expr(node->lhs);
+		if (node->ty->kind == TY_BOOL) {
+			insn = new_insn(IR_CMP);
+			insn->dst = new_vreg();
+			insn->cond = ND_NE;
+			insn->a = a;
+			return insn->dst;
+		}
+		if (node->ty->kind == TY_VOID || cast_narrowing(node->lhs->ty, node->ty) == -1) {
+			return a;
+		}
+		insn = new_insn(IR_CAST);
+		insn->dst = new_vreg();
+		insn->a = a;
+		insn->imm = cast_narrowing(node->lhs->ty, node->ty);
+		return insn->dst;
+	} else if (kind == ND_MEMZERO) {
+		insn = new_insn(IR_ZERO);
+		insn->var = node->var;
+		return 0;
+	} else if (kind == ND_COND || kind == ND_LOGAND || kind == ND_LOGOR) {
+		// Both arms move their value into the same register.
+		dst = new_vreg();
+		then = new_block();
+		els = new_block();
+		end = new_block();
+		if (kind == ND_COND) {
+			lower_cond(node->cond, then, els);
+		} else {
+			lower_cond(node, then, els);
+		}
+		start_block(then);
+		if (kind == ND_COND) {
+			emit_mov(dst, lower_expr(node->then));
+		} else {
+			emit_mov(dst, emit_imm(1));
+		}
+		jump_to(end);
+		start_block(els);
+		if (kind == ND_COND) {
+			emit_mov(dst, lower_expr(node->els));
+		} else {
+			emit_mov(dst, emit_imm(0));
+		}
+		start_block(end);
+		return dst;
+	} else if (kind == ND_NOT) {
+		a = lower_expr(node->lhs);
+		insn = new_insn(IR_CMP);
+		insn->dst = new_vreg();
+		insn->cond = ND_EQ;
+		insn->a = a;
+		return insn->dst;
+	} else if (kind == ND_NEG) {
+		return emit_unary(IR_NEG, lower_expr(node->lhs));
+	} else if (kind == ND_BITNOT) {
+		return emit_unary(IR_NOT, lower_expr(node->lhs));
+	} else if (kind == ND_FUNCALL) {
+		return lower_funcall(node);
+	}
+
+	// Binary
+	int op = binary_op(kind);
+	a = lower_expr(node->lhs);
+	int b = lower_expr(node->rhs);
+	IRInsn *imm = last_imm(b);
+	if (imm && op != IR_DIV && op != IR_MOD) {
+		insn = new_insn(op);
+		insn->imm = imm->imm;
+	} else {
+		insn = new_insn(op);
+		insn->b = b;
+	}
+	insn->dst = new_vreg();
+	insn->a = a;
+	if (op == IR_CMP) {
+		insn->cond = kind;
+		insn->is_unsigned = node->lhs->ty->is_unsigned;
+	} else if (op == IR_SHR) {
+		insn->is_unsigned = node->lhs->ty->is_unsigned;
+	} else {
+		insn->is_unsigned = node->ty->is_unsigned;
+	}
+	return insn->dst;
+}
+
+//
+// Statements
+//
+
+void lower_stmt(Node *node) {
+	int kind = node->kind;
+	BasicBlock *then;
+	BasicBlock *els;
+	BasicBlock *end;
+	IRInsn *insn;
+
+	if (kind == ND_IF) {
+		then = new_block();
+		end = new_block();
+		els = end;
+		if (node->els) {
+			els = new_block();
+		}
+		lower_cond(node->cond, then, els);
+		start_block(then);
+		lower_stmt(node->then);
+		if (node->els) {
+			jump_to(end);
+			start_block(els);
+			lower_stmt(node->els);
+		}
+		start_block(end);
+	} else if (kind == ND_FOR) {
+		if (node->init) {
+			lower_stmt(node->init);
+		}
+		BasicBlock *begin = new_block();
+		start_block(begin);
+		if (node->cond) {
+			then = new_block();
+			lower_cond(node->cond, then, label_block(node->brk_label));
+			start_block(then);
+		}
+		lower_stmt(node->then);
+		start_block(label_block(node->cont_label));
+		if (node->inc) {
+			lower_expr(node->inc);
+		}
+		jump_to(begin);
+		start_block(label_block(node->brk_label));
+	} else if (kind == ND_DO) {
+		then = new_block();
+		start_block(then);
+		lower_stmt(node->then);
+		start_block(label_block(node->cont_label));
+		lower_cond(node->cond, then, label_block(node->brk_label));
+		start_block(label_block(node->brk_label));
+	} else if (kind == ND_SWITCH) {
+		int a = lower_expr(node->cond);
+		int nsuccs = 1;
+		Node *n;
+		for (n = node->case_next; n; n = n->case_next) {
+			nsuccs += 1;
+		}
+
+		insn = new_insn(IR_SWITCH);
+		insn->a = a;
+		insn->node = node;
+		set_succs(cur_block, nsuccs);
+		int i = 0;
+		for (n = node->case_next; n; n = n->case_next) {
+			cur_block->succs[i] = label_block(n->label);
+			i += 1;
+		}
+		if (node->default_case) {
+			cur_block->succs[i] = label_block(node->default_case->label);
+		} else {
+			cur_block->succs[i] = label_block(node->brk_label);
+		}
+
+		lower_stmt(node->then);
+		start_block(label_block(node->brk_label));
+	} else if (kind == ND_CASE) {
+		start_block(label_block(node->label));
+		lower_stmt(node->lhs);
+	} else if (kind == ND_BLOCK) {
+		Node *n;
+		for (n = node->body; n; n = n->next) {
+			lower_stmt(n);
+		}
+	} else if (kind == ND_GOTO) {
+		jump_to(label_block(node->unique_label));
+	} else if (kind == ND_LABEL) {
+		start_block(label_block(node->unique_label));
+		lower_stmt(node->lhs);
+	} else if (kind == ND_RETURN) {
+		int val = 0;
+		if (node->lhs) {
+			val = lower_expr(node->lhs);
+		}
+		insn = new_insn(IR_RET);
+		insn->a = val;
+	} else if (kind == ND_EXPR_STMT) {
+		lower_expr(node->lhs);
+	} else {
+		error_tok(node->tok, "invalid statement");
+	}
+}
+
+// Returns true if an instruction does nothing but compute its result.
+int is_pure(int op) {
+	return op != IR_STORE && op != IR_COPY && op != IR_ZERO && op != IR_ARG &&
+		op != IR_CALL && !is_terminator(op);
+}
+
+// Remove instructions whose results are never used. Going backwards,
+// the operands of a removed instruction may become unused in turn.
+void eliminate_dead_code(IRFunc *ir) {
+	int *uses = arena_alloc(scratch_arena, (ir->nvregs + 1) * sizeof(int));
+	int ninsns = 0;
+	BasicBlock *bb;
+	IRInsn *insn;
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		for (insn = bb->insns; insn; insn = insn->next) {
+			uses[insn->a] += 1;
+			uses[insn->b] += 1;
+			ninsns += 1;
+		}
+	}
+
+	IRInsn **insns = arena_alloc(scratch_arena, ninsns * sizeof(IRInsn*));
+	int i = 0;
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		for (insn = bb->insns; insn; insn = insn->next) {
+			insns[i] = insn;
+			i += 1;
+		}
+	}
+
+	for (i = ninsns - 1; i >= 0; i -= 1) {
+		insn = insns[i];
+		if (!is_pure(insn->op) || uses[insn->dst] != 0) {
+			continue;
+		}
+		uses[insn->a] -= 1;
+		uses[insn->b] -= 1;
+		insn->op = IR_NOP;
+		insn->dst = 0;
+		insn->a = 0;
+		insn->b = 0;
+	}
+}
+
+// Lower the body of a function definition.
+IRFunc *lower_function(Obj *fn) {
+	ir_fn = arena_alloc(scratch_arena, sizeof(IRFunc));
+	ir_fn->fn = fn;
+	cur_block = NULL;
+	last_block = NULL;
+	label_blocks = NULL;
+
+	start_block(new_block());
+	lower_stmt(fn->body);
+	if (!is_terminated(cur_block)) {
+		new_insn(IR_RET);
+	}
+	eliminate_dead_code(ir_fn);
+	return ir_fn;
+}
@@ -2,12 +2,15 @@
 
 int opt_cc1;
 int opt_hash_hash_hash;
+int opt_ffold = TRUE;
+int opt_fir = TRUE;
+int opt_fpeephole = TRUE;
 char *opt_o;
 
 char *input_path;
 
 void usage(int status) {
-	fputs("chibicc [ -o <path> ] <file>\n", stderr);
+	fputs("chibicc [ -o <path> ] [ -fno-fold ] [ -fno-ir ] [ -fno-peephole ] <file>\n", stderr);
 	exit(status);
 }
 
@@ -25,6 +28,36 @@ void parse_args(int argc, char **argv) {
 			continue;
 		}
 
+		if (!strcmp(argv[i], "-ffold")) {
+			opt_ffold = TRUE;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-fno-fold")) {
+			opt_ffold = FALSE;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-fir")) {
+			opt_fir = TRUE;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-fno-ir")) {
+			opt_fir = FALSE;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-fpeephole")) {
+			opt_fpeephole = TRUE;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-fno-peephole")) {
+			opt_fpeephole = FALSE;
+			continue;
+		}
+
 		if (!strcmp(argv[i], "--help")) {
 			usage(0);
 		}
@@ -117,11 +150,18 @@ void run_cc1(int argc, char **argv) {
 
 void cc1(void) {
 	// Initialisation
+	initialize_arenas();
 	initialize_types();
+	initialize_keywords();
+	initialize_puncts();
+	initialize_idents();
 
 	// Tokenize, parse.
 	Token *tok = tokenize_file(input_path);
 	Obj *prog = parse(tok);
+	if (opt_ffold) {
+		fold_constants(prog);
+	}
 
 	// Traverse the AST, emitting assembly.
 	FILE *out = open_file(opt_o);
@@ -19,6 +19,8 @@
 // Scope for local & global variables, typedefs, or enum constants.
 struct VarScope {
 	struct VarScope *next;
+	struct VarScope *hash_next; // Next entry in the same var_table bucket
+	int hash;
 	char *name;
 	Obj *var;
 	Type *type_def;
@@ -30,6 +32,9 @@ typedef struct VarScope VarScope;
 // Scope for struct, union or enum tags.
 struct TagScope {
 	struct TagScope *next;
+	struct TagScope *hash_next; // Next entry in the same tag_table bucket
+	int hash;
+	int depth;
 	char *name;
 	Type *ty;
 };
@@ -38,6 +43,7 @@ typedef struct TagScope TagScope;
 // Represents a block scope.
 struct Scope {
 	struct Scope *next;
+	int depth;
 
 	// C has two block scopes; one is for variables, the other for tags.
 	VarScope *vars;
@@ -66,11 +72,22 @@ struct Initializer {
 	Node *expr;
 
 	// If it is an initializer for an aggregate type (array or struct, for eg),
-	// this is the initializers for its children.
+	// this is the initializers for its children. Those of an array are
+	// created as its elements are initialized, so only the first nchildren
+	// exist and the elements after them are zero.
 	struct Initializer **children;
+	int nchildren;
+	int capacity;
 };
 typedef struct Initializer Initializer;
 
+// Hidden pointer variable for compound assignments at one nesting depth.
+struct AssignTmp {
+	struct AssignTmp *next;
+	Obj *var;
+};
+typedef struct AssignTmp AssignTmp;
+
 // For local variable initializer.
 struct InitDesg {
 	struct InitDesg *next;
@@ -82,6 +99,15 @@ typedef struct InitDesg InitDesg;
 
 Scope *scope;
 
+// Every visible name is also entered into a hash table, one for variables
+// and one for tags. Entries are pushed onto the front of their bucket, so
+// the first match in a bucket is the innermost declaration, and
+// leave_scope() can unlink a scope's entries from the bucket heads.
+#define SCOPE_TABLE_SIZE 4096
+
+VarScope **var_table;
+TagScope **tag_table;
+
 // Points to the function currently being parsed.
 Obj *parsing_fn;
 
@@ -94,6 +120,11 @@ Node *labels;
 Obj *locals;
 Obj *globals;
 
+// Hidden variables for compound assignments in the current function, and
+// how deeply the compound assignment being parsed is nested.
+AssignTmp *assign_tmps;
+int assign_depth;
+
 // Current "break" and "continue" jump targets.
 char *brk_label;
 char *cont_label;
@@ -102,46 +133,76 @@ char *cont_label;
 // Otherwise, NULL.
 Node *current_switch;
 
+int scope_hash(char *name) {
+	uint32_t h = 2166136261;
+	while (*name) {
+		h = (h ^ *name) * 16777619;
+		name += 1;
+	}
+	return h & (SCOPE_TABLE_SIZE - 1);
+}
+
 void enter_scope(void) {
-	Scope *sc = calloc(1, sizeof(Scope));
+	Scope *sc = arena_alloc(ast_arena, sizeof(Scope));
 	sc->next = scope;
+	sc->depth = scope->depth + 1;
 	scope = sc;
 }
 
 void leave_scope(void) {
+	// Entries of the innermost scope are always at the front of their
+	// buckets, most recent first, in the same order as scope->vars.
+	VarScope *vsc;
+	for (vsc = scope->vars; vsc; vsc = vsc->next) {
+		var_table[vsc->hash] = vsc->hash_next;
+	}
+	TagScope *tsc;
+	for (tsc = scope->tags; tsc; tsc = tsc->next) {
+		tag_table[tsc->hash] = tsc->hash_next;
+	}
 	scope = scope->next;
 }
 
-// Find a variable by name.
+// Find a variable by name. Names are interned, so they are compared by
+// pointer.
 VarScope *find_var(Token *tok) {
-	Obj *var;
-	Scope *sc;
+	if (tok->ident == NULL) {
+		return NULL;
+	}
+
 	VarScope *vsc;
-	for (sc = scope; sc; sc = sc->next) {
-		for (vsc = sc->vars; vsc; vsc = vsc->next) {
-			if (equal(tok, vsc->name)) {
-				return vsc;
-			}
+	for (vsc = var_table[scope_hash(tok->ident)]; vsc; vsc = vsc->hash_next) {
+		if (vsc->name == tok->ident) {
+			return vsc;
 		}
 	}
 	return NULL;
 }
 
-Type *find_tag(Token *tok) {
-	Scope *sc;
+TagScope *find_tag_scope(Token *tok) {
+	if (tok->ident == NULL) {
+		return NULL;
+	}
+
 	TagScope *tsc;
-	for (sc = scope; sc; sc = sc->next) {
-		for (tsc = sc->tags; tsc; tsc = tsc->next) {
-			if (equal(tok, tsc->name)) {
-				return tsc->ty;
-			}
+	for (tsc = tag_table[scope_hash(tok->ident)]; tsc; tsc = tsc->hash_next) {
+		if (tsc->name == tok->ident) {
+			return tsc;
 		}
 	}
 	return NULL;
 }
 
+Type *find_tag(Token *tok) {
+	TagScope *tsc = find_tag_scope(tok);
+	if (tsc == NULL) {
+		return NULL;
+	}
+	return tsc->ty;
+}
+
 Node *new_node(int kind, Token *tok) {
-	Node *node = calloc(1, sizeof(Node));
+	Node *node = arena_alloc(ast_arena, sizeof(Node));
 	node->kind = kind;
 	node->tok = tok;
 	return node;
@@ -182,25 +243,29 @@ Node *new_var_node(Obj *var, Token *tok) {
 Node *new_cast(Node *expr, Type *ty) {
 	add_type(expr);
 
-	Node *node = calloc(1, sizeof(Node));
+	Node *node = arena_alloc(ast_arena, sizeof(Node));
 	node->kind = ND_CAST;
 	node->tok = expr->tok;
 	node->lhs = expr;
-	node->ty = copy_type(ty);
+	node->ty = ty;
 	return node;
 }
 
 // Add a variable to the current scope.
 VarScope *push_scope(char *name) {
-	VarScope *sc = calloc(1, sizeof(VarScope));
+	VarScope *sc = arena_alloc(ast_arena, sizeof(VarScope));
 	sc->name = name;
 	sc->next = scope->vars;
 	scope->vars = sc;
+
+	sc->hash = scope_hash(name);
+	sc->hash_next = var_table[sc->hash];
+	var_table[sc->hash] = sc;
 	return sc;
 }
 
 Initializer *new_initializer(Type *ty, int is_flexible) {
-	Initializer *init = calloc(1, sizeof(Initializer));
+	Initializer *init = arena_alloc(ast_arena, sizeof(Initializer));
 	init->ty = ty;
 
 	if (ty->kind == TY_ARRAY) {
@@ -209,11 +274,7 @@ Initializer *new_initializer(Type *ty, int is_flexible) {
 			return init;
 		}
 
-		init->children = calloc(ty->array_len, sizeof(Initializer*));
-		int i;
-		for (i = 0; i < ty->array_len; i += 1) {
-			init->children[i] = new_initializer(ty->base, FALSE);
-		}
+		return init;
 	} else if (ty->kind == TY_STRUCT || ty->kind == TY_UNION) {
 		// Count the number of struct members.
 		int len = 0;
@@ -222,12 +283,12 @@ Initializer *new_initializer(Type *ty, int is_flexible) {
 			len += 1;
 		}
 
-		init->children = calloc(len, sizeof(Initializer*));
+		init->children = arena_alloc(ast_arena, len * sizeof(Initializer*));
 
 		Initializer *child;
 		for (mem = ty->members; mem; mem = mem->next) {
 			if (is_flexible && ty->is_flexible && mem->next == NULL) {
-				child = calloc(1, sizeof(Initializer));
+				child = arena_alloc(ast_arena, sizeof(Initializer));
 				child->ty = mem->ty;
 				child->is_flexible = TRUE;
 				init->children[mem->idx] = child;
@@ -240,8 +301,37 @@ Initializer *new_initializer(Type *ty, int is_flexible) {
 	return init;
 }
 
+// Returns the initializer for element i of an array, creating it and any
+// before it that do not exist yet.
+Initializer *array_child(Initializer *init, int i) {
+	int cap;
+	Initializer **children;
+	if (i >= init->capacity) {
+		cap = init->capacity * 2;
+		if (cap < 8) {
+			cap = 8;
+		}
+		if (cap <= i) {
+			cap = i + 1;
+		}
+		if (cap > init->ty->array_len) {
+			cap = init->ty->array_len;
+		}
+		children = arena_alloc(ast_arena, cap * sizeof(Initializer*));
+		memcpy(children, init->children, init->nchildren * sizeof(Initializer*));
+		init->children = children;
+		init->capacity = cap;
+	}
+
+	while (init->nchildren <= i) {
+		init->children[init->nchildren] = new_initializer(init->ty->base, FALSE);
+		init->nchildren += 1;
+	}
+	return init->children[i];
+}
+
 Obj *new_var(char *name, Type *ty) {
-	Obj *var = calloc(1, sizeof(Obj));
+	Obj *var = arena_alloc(ast_arena, sizeof(Obj));
 	var->name = name;
 	var->ty = ty;
 	var->align = ty->align;
@@ -287,18 +377,20 @@ char *get_ident(Token *tok) {
 	if (tok->kind != TK_IDENT) {
 		error_tok(tok, "expected an identifier");
 	}
-	char *new = calloc(tok->len + 1, sizeof(char));
-	strncpy(new, tok->loc, tok->len);
-	return new;
+	return tok->ident;
 }
 
 void push_tag_scope(Token *tok, Type *ty) {
-	TagScope *sc = calloc(1, sizeof(TagScope));
-	sc->name = calloc(tok->len + 1, sizeof(char));
-	strncpy(sc->name, tok->loc, tok->len);
+	TagScope *sc = arena_alloc(ast_arena, sizeof(TagScope));
+	sc->name = tok->ident;
 	sc->ty = ty;
+	sc->depth = scope->depth;
 	sc->next = scope->tags;
 	scope->tags = sc;
+
+	sc->hash = scope_hash(sc->name);
+	sc->hash_next = tag_table[sc->hash];
+	tag_table[sc->hash] = sc;
 }
 
 Type *find_typedef(Token *tok) {
@@ -313,29 +405,10 @@ Type *find_typedef(Token *tok) {
 
 // Returns true if a given token represents a type.
 int is_typename(Token *tok) {
-	return equal(tok, "_Bool") ||
-		equal(tok, "char") ||
-		equal(tok, "short") ||
-		equal(tok, "int") ||
-		equal(tok, "long") ||
-		equal(tok, "struct") ||
-		equal(tok, "union") ||
-		equal(tok, "void") ||
-		equal(tok, "typedef") ||
-		equal(tok, "enum") ||
-		equal(tok, "static") ||
-		equal(tok, "extern") ||
-		equal(tok, "signed") ||
-		equal(tok, "unsigned") ||
-		equal(tok, "const") ||
-		equal(tok, "volatile") ||
-		equal(tok, "auto") ||
-		equal(tok, "register") ||
-		equal(tok, "restrict") ||
-		equal(tok, "__restrict") ||
-		equal(tok, "__restrict__") ||
-		equal(tok, "_Noreturn") ||
-		find_typedef(tok) != NULL;
+	if (tok->kind == TK_KEYWORD) {
+		return tok->keyword <= KW_NORETURN;
+	}
+	return find_typedef(tok) != NULL;
 }
 
 Type *declspec(Token **rest, Token *tok, VarAttr *attr);
@@ -417,23 +490,21 @@ Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
 	Type *ty2;
 	while (is_typename(tok)) {
 		// Recognise but ignore these.
-		if (consume(&tok, tok, "const") || consume(&tok, tok, "volatile") ||
-				consume(&tok, tok, "auto") || consume(&tok, tok, "register") ||
-				consume(&tok, tok, "restrict") || consume(&tok, tok, "__restrict") ||
-				consume(&tok, tok, "__restrict__") || consume(&tok, tok, "_Noreturn")) {
+		if (tok->keyword >= KW_CONST && tok->keyword <= KW_NORETURN) {
+			tok = tok->next;
 			continue;
 		}
 
 		// Handle storage class specifiers.
-		if (equal(tok, "typedef") || equal(tok, "static") || equal(tok, "extern")) {
+		if (tok->keyword == KW_TYPEDEF || tok->keyword == KW_STATIC || tok->keyword == KW_EXTERN) {
 			if (attr == NULL) {
 				error_tok(tok, "storage class specifier is not allowed in this context");
 			}
-			if (equal(tok, "typedef")) {
+			if (tok->keyword == KW_TYPEDEF) {
 				attr->is_typedef = TRUE;
-			} else if (equal(tok, "static")) {
+			} else if (tok->keyword == KW_STATIC) {
 				attr->is_static = TRUE;
-			} else if (equal(tok, "extern")) {
+			} else if (tok->keyword == KW_EXTERN) {
 				attr->is_extern = TRUE;
 			}
 
@@ -446,16 +517,16 @@ Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
 
 		// User-defined types.
 		ty2 = find_typedef(tok);
-		if (equal(tok, "struct") || equal(tok, "union") || equal(tok, "enum") || ty2 != NULL) {
+		if (tok->keyword == KW_STRUCT || tok->keyword == KW_UNION || tok->keyword == KW_ENUM || ty2 != NULL) {
 			if (counter) {
 				break;
 			}
 
-			if (equal(tok, "struct")) {
+			if (tok->keyword == KW_STRUCT) {
 				ty = struct_decl(&tok, tok->next);
-			} else if (equal(tok, "union")) {
+			} else if (tok->keyword == KW_UNION) {
 				ty = union_decl(&tok, tok->next);
-			} else if (equal(tok, "enum")) {
+			} else if (tok->keyword == KW_ENUM) {
 				ty = enum_specifier(&tok, tok->next);
 			} else {
 				ty = ty2;
@@ -466,21 +537,21 @@ Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
 		}
 
 		// Handle built-in types.
-		if (equal(tok, "void")) {
+		if (tok->keyword == KW_VOID) {
 			counter += VOID;
-		} else if (equal(tok, "_Bool")) {
+		} else if (tok->keyword == KW_BOOL) {
 			counter += BOOL;
-		} else if (equal(tok, "char")) {
+		} else if (tok->keyword == KW_CHAR) {
 			counter += CHAR;
-		} else if (equal(tok, "short")) {
+		} else if (tok->keyword == KW_SHORT) {
 			counter += SHORT;
-		} else if (equal(tok, "int")) {
+		} else if (tok->keyword == KW_INT) {
 			counter += INT;
-		} else if (equal(tok, "long")) {
+		} else if (tok->keyword == KW_LONG) {
 			counter += LONG;
-		} else if (equal(tok, "signed")) {
+		} else if (tok->keyword == KW_SIGNED) {
 			counter |= SIGNED;
-		} else if (equal(tok, "unsigned")) {
+		} else if (tok->keyword == KW_UNSIGNED) {
 			counter |= UNSIGNED;
 		} else {
 			error("internal error in declspec, invalid type");
@@ -532,17 +603,17 @@ Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
 // func-params = ("void" | param ("," param)*)? ")"
 // param       = declspec declarator
 Type *func_params(Token **rest, Token *tok, Type *ty) {
-	if (equal(tok, "void") && equal(tok->next, ")")) {
+	if (tok->keyword == KW_VOID && tok->next->punct == ')') {
 		*rest = tok->next->next;
 		return func_type(ty);
 	}
 
-	Type *head = calloc(1, sizeof(Type));
+	Type *head = arena_alloc(ast_arena, sizeof(Type));
 	Type *cur = head;
 
 	Type *nextty;
 	Token *name;
-	while (!equal(tok, ")")) {
+	while (tok->punct != ')') {
 		if (cur != head) {
 			tok = skip(tok, ",");
 		}
@@ -570,11 +641,11 @@ Type *func_params(Token **rest, Token *tok, Type *ty) {
 
 // array-dimensions = ("static" | "restrict")* const-expr? "]" type-suffix
 Type *array_dimensions(Token **rest, Token *tok, Type *ty) {
-	while (equal(tok, "static") || equal(tok, "restrict")) {
+	while (tok->keyword == KW_STATIC || tok->keyword == KW_RESTRICT) {
 		tok = tok->next;
 	}
 
-	if (equal(tok, "]")) {
+	if (tok->punct == ']') {
 		ty = type_suffix(rest, tok->next, ty);
 		return array_of(ty, -1);
 	}
@@ -589,11 +660,11 @@ Type *array_dimensions(Token **rest, Token *tok, Type *ty) {
 //             | "[" array-dimensions
 //             | ε
 Type *type_suffix(Token **rest, Token *tok, Type *ty) {
-	if (equal(tok, "(")) {
+	if (tok->punct == '(') {
 		return func_params(rest, tok->next, ty);
 	}
 
-	if (equal(tok, "[")) {
+	if (tok->punct == '[') {
 		return array_dimensions(rest, tok->next, ty);
 	}
 
@@ -605,9 +676,9 @@ Type *type_suffix(Token **rest, Token *tok, Type *ty) {
 Type *pointers(Token **rest, Token *tok, Type *ty) {
 	while (consume(&tok, tok, "*")) {
 		ty = pointer_to(ty);
-		while (equal(tok, "const") || equal(tok, "volatile") ||
-				equal(tok, "restrict") || equal(tok, "__restrict") ||
-				equal(tok, "__restrict__")) {
+		while (tok->keyword == KW_CONST || tok->keyword == KW_VOLATILE ||
+				tok->keyword == KW_RESTRICT || tok->keyword == KW___RESTRICT ||
+				tok->keyword == KW___RESTRICT__) {
 			tok = tok->next;
 		}
 	}
@@ -619,9 +690,9 @@ Type *pointers(Token **rest, Token *tok, Type *ty) {
 Type *declarator(Token **rest, Token *tok, Type *ty) {
 	ty = pointers(&tok, tok, ty);
 
-	if (equal(tok, "(")) {
+	if (tok->punct == '(') {
 		Token *start = tok;
-		Type *dummy = calloc(1, sizeof(Type));
+		Type *dummy = arena_alloc(scratch_arena, sizeof(Type));
 		declarator(&tok, start->next, dummy);
 		tok = skip(tok, ")");
 		ty = type_suffix(rest, tok, ty);
@@ -646,9 +717,9 @@ Type *declarator(Token **rest, Token *tok, Type *ty) {
 Type *abstract_declarator(Token **rest, Token *tok, Type *ty) {
 	ty = pointers(&tok, tok, ty);
 
-	if (equal(tok, "(")) {
+	if (tok->punct == '(') {
 		Token *start = tok;
-		Type *dummy = calloc(1, sizeof(Type));
+		Type *dummy = arena_alloc(scratch_arena, sizeof(Type));
 		abstract_declarator(&tok, start->next, dummy);
 		tok = skip(tok, ")");
 		ty = type_suffix(rest, tok, ty);
@@ -665,16 +736,16 @@ Type *typename(Token **rest, Token *tok) {
 }
 
 int expr_is_end(Token *tok) {
-	return equal(tok, "}") || (equal(tok, ",") && equal(tok->next, "}"));
+	return tok->punct == '}' || (tok->punct == ',' && tok->next->punct == '}');
 }
 
 int expr_consume_end(Token **rest, Token *tok) {
-	if (equal(tok, "}")) {
+	if (tok->punct == '}') {
 		*rest = tok->next;
 		return TRUE;
 	}
 
-	if (equal(tok, ",") && equal(tok->next, "}")) {
+	if (tok->punct == ',' && tok->next->punct == '}') {
 		*rest = tok->next->next;
 		return TRUE;
 	}
@@ -695,7 +766,7 @@ Type *enum_specifier(Token **rest, Token *tok){
 		tok = tok->next;
 	}
 
-	if (tag != NULL && !equal(tok, "{")) {
+	if (tag != NULL && tok->punct != '{') {
 		Type *ty = find_tag(tag);
 		if (ty == NULL) {
 			error_tok(tag, "unknown enum type");
@@ -723,7 +794,7 @@ Type *enum_specifier(Token **rest, Token *tok){
 		name = get_ident(tok);
 		tok = tok->next;
 
-		if (equal(tok, "=")) {
+		if (tok->punct == '=') {
 			val = const_expr(&tok, tok->next);
 		}
 
@@ -741,7 +812,7 @@ Type *enum_specifier(Token **rest, Token *tok){
 
 // declaration = declspec (declarator ("=" expr)? ("," declarator ("=" expr)?)*)? ";"
 Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr) {
-	Node *head = calloc(1, sizeof(Node));
+	Node *head = arena_alloc(ast_arena, sizeof(Node));
 	Node *cur = head;
 	int i = 0;
 
@@ -749,7 +820,7 @@ Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr) {
 	Obj *var;
 	Node *expr;
 	VarScope *vs;
-	while (!equal(tok, ";")) {
+	while (tok->punct != ';') {
 		if (i > 0) {
 			tok = skip(tok, ",");
 		}
@@ -770,7 +841,7 @@ Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr) {
 				var = new_anon_gvar(ty);
 				vs = push_scope(get_ident(ty->name));
 				vs->var = var;
-				if (equal(tok, "=")) {
+				if (tok->punct == '=') {
 					gvar_initializer(&tok, tok->next, var);
 				}
 				continue;
@@ -784,7 +855,7 @@ Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr) {
 			}
 		}
 
-		if (equal(tok, "=")) {
+		if (tok->punct == '=') {
 			expr = lvar_initializer(&tok, tok->next, var);
 			cur->next = new_unary(ND_EXPR_STMT, expr, tok);
 			cur = cur->next;
@@ -805,7 +876,7 @@ Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr) {
 }
 
 Token *skip_excess_element(Token *tok) {
-	if (equal(tok, "{")) {
+	if (tok->punct == '{') {
 		tok = skip_excess_element(tok->next);
 		return skip(tok, "}");
 	}
@@ -828,7 +899,7 @@ void string_initializer(Token **rest, Token *tok, Initializer *init) {
 	int i;
 	Initializer *child;
 	for (i = 0; i < len; i += 1) {
-		child = init->children[i];
+		child = array_child(init, i);
 		child->expr = new_num(tok->str[i], tok);
 	}
 	*rest = tok->next;
@@ -864,7 +935,7 @@ void array_initializer1(Token **rest, Token *tok, Initializer *init) {
 		}
 
 		if (i < init->ty->array_len) {
-			initializer2(&tok, tok, init->children[i]);
+			initializer2(&tok, tok, array_child(init, i));
 		} else {
 			tok = skip_excess_element(tok);
 		}
@@ -885,7 +956,7 @@ void array_initializer2(Token **rest, Token *tok, Initializer *init) {
 			tok = skip(tok, ",");
 		}
 
-		initializer2(&tok, tok, init->children[i]);
+		initializer2(&tok, tok, array_child(init, i));
 	}
 
 	*rest = tok;
@@ -930,7 +1001,7 @@ void struct_initializer2(Token **rest, Token *tok, Initializer *init) {
 void union_initializer(Token **rest, Token *tok, Initializer *init) {
 	// Unlike structs, union initializers take only one initializer,
 	// initializing the first union member.
-	if (equal(tok, "{")) {
+	if (tok->punct == '{') {
 		initializer2(&tok, tok->next, init->children[0]);
 		consume(&tok, tok, ",");
 		*rest = skip(tok, "}");
@@ -947,14 +1018,14 @@ void initializer2(Token **rest, Token *tok, Initializer *init) {
 		if (tok->kind == TK_STR) {
 			string_initializer(rest, tok, init);
 		} else {
-			if (equal(tok, "{")) {
+			if (tok->punct == '{') {
 				array_initializer1(rest, tok, init);
 			} else {
 				array_initializer2(rest, tok, init);
 			}
 		}
 	} else if (init->ty->kind == TY_STRUCT) {
-		if (equal(tok, "{")) {
+		if (tok->punct == '{') {
 			struct_initializer1(rest, tok, init);
 			return;
 		}
@@ -972,7 +1043,7 @@ void initializer2(Token **rest, Token *tok, Initializer *init) {
 	} else if (init->ty->kind == TY_UNION) {
 		union_initializer(rest, tok, init);
 	} else {
-		if (equal(tok, "{")) {
+		if (tok->punct == '{') {
 			// An initializer for a scalar variable can be surrounded by
 			// braces.
 			initializer2(&tok, tok->next, init);
@@ -986,12 +1057,12 @@ void initializer2(Token **rest, Token *tok, Initializer *init) {
 Type *copy_struct_type(Type *ty) {
 	ty = copy_type(ty);
 
-	Member *head = calloc(1, sizeof(Member));
+	Member *head = arena_alloc(ast_arena, sizeof(Member));
 	Member *cur = head;
 	Member *mem;
 	Member *m;
 	for (mem = ty->members; mem != NULL; mem = mem->next) {
-		m = calloc(1, sizeof(Member));
+		m = arena_alloc(ast_arena, sizeof(Member));
 		memcpy(m, mem, sizeof(Member));
 		cur->next = m;
 		cur = m;
@@ -1040,48 +1111,62 @@ Node *init_desg_expr(InitDesg *desg, Token *tok) {
 	return new_unary(ND_DEREF, new_add(lhs, rhs, tok), tok);
 }
 
+// Either of node and rhs may be NULL.
+Node *append_lvar_init(Node *node, Node *rhs, Token *tok) {
+	if (node == NULL) {
+		return rhs;
+	}
+	if (rhs == NULL) {
+		return node;
+	}
+	return new_binary(ND_COMMA, node, rhs, tok);
+}
+
+// Returns assignments for the elements of an initializer that are set to
+// something other than zero, or NULL if there are none. The variable has
+// been zeroed beforehand, so that is all that is left to store.
 Node *create_lvar_init(Initializer *init, Type *ty, InitDesg *desg, Token *tok) {
 	if (ty->kind == TY_ARRAY) {
-		Node *node = new_node(ND_NULL_EXPR, tok);
+		Node *node = NULL;
+		InitDesg *desg2 = arena_alloc(ast_arena, sizeof(InitDesg));
+		desg2->next = desg;
 		int i;
-		InitDesg *desg2;
 		Node *rhs;
-		for (i = 0; i < ty->array_len; i += 1) {
-			desg2 = calloc(1, sizeof(InitDesg));
-			desg2->next = desg;
+		for (i = 0; i < init->nchildren; i += 1) {
 			desg2->idx = i;
 			rhs = create_lvar_init(init->children[i], ty->base, desg2, tok);
-			node = new_binary(ND_COMMA, node, rhs, tok);
+			node = append_lvar_init(node, rhs, tok);
 		}
 		return node;
 	}
 
 	if (ty->kind == TY_STRUCT && init->expr == NULL) {
-		Node *node = new_node(ND_NULL_EXPR, tok);
-
+		Node *node = NULL;
+		InitDesg *desg2 = arena_alloc(ast_arena, sizeof(InitDesg));
+		desg2->next = desg;
 		Member *mem;
-		InitDesg *desg2;
 		Node *rhs;
 		for (mem = ty->members; mem; mem = mem->next) {
-			desg2 = calloc(1, sizeof(InitDesg));
-			desg2->next = desg;
 			desg2->member = mem;
 			rhs = create_lvar_init(init->children[mem->idx], mem->ty, desg2, tok);
-			node = new_binary(ND_COMMA, node, rhs, tok);
+			node = append_lvar_init(node, rhs, tok);
 		}
 		return node;
 	}
 
 	if (ty->kind == TY_UNION) {
 		InitDesg *desg2;
-		desg2 = calloc(1, sizeof(InitDesg));
+		desg2 = arena_alloc(ast_arena, sizeof(InitDesg));
 		desg2->next = desg;
 		desg2->member = ty->members;
 		return create_lvar_init(init->children[0], ty->members->ty, desg2, tok);
 	}
 
 	if (init->expr == NULL) {
-		return new_node(ND_NULL_EXPR, tok);
+		return NULL;
+	}
+	if (init->expr->kind == ND_NUM && init->expr->val == 0) {
+		return NULL;
 	}
 
 	Node *lhs = init_desg_expr(desg, tok);
@@ -1093,23 +1178,32 @@ Node *create_lvar_init(Initializer *init, Type *ty, InitDesg *desg, Token *tok)
 // assignment expressions for an initializer.
 Node *lvar_initializer(Token **rest, Token *tok, Obj *var) {
 	// XXX What the hell?
-	Type **new_ty = calloc(1, sizeof(Type*));
+	Type **new_ty = arena_alloc(ast_arena, sizeof(Type*));
 	Initializer *init = initializer(rest, tok, var->ty, new_ty);
 	var->ty = *new_ty;
-	InitDesg *desg = calloc(1, sizeof(InitDesg));
+	InitDesg *desg = arena_alloc(ast_arena, sizeof(InitDesg));
 	desg->next = NULL;
 	desg->idx = 0;
 	desg->member = NULL;
 	desg->var = var;
 
+	Node *rhs = create_lvar_init(init, var->ty, desg, tok);
+
+	// A scalar is entirely overwritten by its initializer.
+	int kind = var->ty->kind;
+	if (rhs != NULL && kind != TY_ARRAY && kind != TY_STRUCT && kind != TY_UNION) {
+		return rhs;
+	}
+
 	// If a partial initializer list is given, the standard requires
 	// unspecified elements are set to 0.
-	// The easiest solution is to zero the entire region before initializing
-	// it with user-supplied values.
+	// The easiest solution is to zero the entire region in one go before
+	// storing the elements that are not zero.
 	Node *lhs = new_node(ND_MEMZERO, tok);
 	lhs->var = var;
-
-	Node *rhs = create_lvar_init(init, var->ty, desg, tok);
+	if (rhs == NULL) {
+		return lhs;
+	}
 	return new_binary(ND_COMMA, lhs, rhs, tok);
 }
 
@@ -1138,7 +1232,7 @@ Relocation *write_gvar_data(Relocation *cur, Initializer *init, Type *ty, char *
 	if (ty->kind == TY_ARRAY) {
 		int sz = ty->base->size;
 		int i;
-		for (i = 0; i < ty->array_len; i += 1) {
+		for (i = 0; i < init->nchildren; i += 1) {
 			// XXX For some reason order of operations is a bit cracked in
 			// M2-Planet for offset calc.
 			cur = write_gvar_data(cur, init->children[i], ty->base, buf, offset + (sz * i));
@@ -1171,7 +1265,7 @@ Relocation *write_gvar_data(Relocation *cur, Initializer *init, Type *ty, char *
 		return cur;
 	}
 
-	Relocation *rel = calloc(1, sizeof(Relocation));
+	Relocation *rel = arena_alloc(ast_arena, sizeof(Relocation));
 	rel->offset = offset;
 	rel->var = var;
 	rel->addend = val;
@@ -1184,15 +1278,15 @@ Relocation *write_gvar_data(Relocation *cur, Initializer *init, Type *ty, char *
 // compile error if an initializer list contains a non-constant expression.
 void gvar_initializer(Token **rest, Token *tok, Obj *var) {
 	// XXX Again, why?
-	Type **new_ty = calloc(1, sizeof(Type*));
+	Type **new_ty = arena_alloc(ast_arena, sizeof(Type*));
 	Initializer *init = initializer(rest, tok, var->ty, new_ty);
 	var->ty = *new_ty;
 
-	Relocation *head = calloc(1, sizeof(Relocation));
-	// We should really be callocing size var->ty->size, but M2-Planet does not
-	// comply.
-	// We should also be using char* but that causes M2-Planet to segfault (why?)
-	int *buf = calloc(1, 8);
+	Relocation *head = arena_alloc(ast_arena, sizeof(Relocation));
+	// We should be using char* but that causes M2-Planet to segfault (why?)
+	// write_gvar_buf() stores a whole int even for smaller types, so the
+	// last value may spill up to 3 bytes past the end.
+	int *buf = calloc(var->ty->size + 4, sizeof(char));
 	write_gvar_data(head, init, var->ty, buf, 0);
 	var->init_data = buf;
 	var->rel = head->next;
@@ -1216,7 +1310,7 @@ void gvar_initializer(Token **rest, Token *tok, Obj *var) {
 //      | "{" compound-stmt
 //      | expr-stmt
 Node *stmt(Token **rest, Token *tok) {
-	if (equal(tok, "return")) {
+	if (tok->keyword == KW_RETURN) {
 		Node *node = new_node(ND_RETURN, tok);
 		if (consume(rest, tok->next, ";")) {
 			return node;
@@ -1230,20 +1324,20 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "if")) {
+	if (tok->keyword == KW_IF) {
 		Node *node = new_node(ND_IF, tok);
 		tok = skip(tok->next, "(");
 		node->cond = expr(&tok, tok);
 		tok = skip(tok, ")");
 		node->then = stmt(&tok, tok);
-		if (equal(tok, "else")) {
+		if (tok->keyword == KW_ELSE) {
 			node->els = stmt(&tok, tok->next);
 		}
 		*rest = tok;
 		return node;
 	}
 
-	if (equal(tok, "switch")) {
+	if (tok->keyword == KW_SWITCH) {
 		Node *node = new_node(ND_SWITCH, tok);
 		tok = skip(tok->next, "(");
 		node->cond = expr(&tok, tok);
@@ -1263,7 +1357,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "case")) {
+	if (tok->keyword == KW_CASE) {
 		if (current_switch == NULL) {
 			error_tok(tok, "stray case");
 		}
@@ -1279,7 +1373,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "default")) {
+	if (tok->keyword == KW_DEFAULT) {
 		if (current_switch == NULL) {
 			error_tok(tok, "stray default");
 		}
@@ -1292,7 +1386,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "for")) {
+	if (tok->keyword == KW_FOR) {
 		Node *node = new_node(ND_FOR, tok);
 		tok = skip(tok->next, "(");
 
@@ -1312,12 +1406,12 @@ Node *stmt(Token **rest, Token *tok) {
 			node->init = expr_stmt(&tok, tok);
 		}
 
-		if (!equal(tok, ";")) {
+		if (tok->punct != ';') {
 			node->cond = expr(&tok, tok);
 		}
 		tok = skip(tok, ";");
 
-		if (!equal(tok, ")")) {
+		if (tok->punct != ')') {
 			node->inc = expr(&tok, tok);
 		}
 		tok = skip(tok, ")");
@@ -1329,7 +1423,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "while")) {
+	if (tok->keyword == KW_WHILE) {
 		Node *node = new_node(ND_FOR, tok);
 		tok = skip(tok->next, "(");
 		node->cond = expr(&tok, tok);
@@ -1347,7 +1441,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "do")) {
+	if (tok->keyword == KW_DO) {
 		Node *node = new_node(ND_DO, tok);
 
 		char *brk = brk_label;
@@ -1370,7 +1464,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "goto")) {
+	if (tok->keyword == KW_GOTO) {
 		Node *node = new_node(ND_GOTO, tok);
 		node->label = get_ident(tok->next);
 		node->goto_next = gotos;
@@ -1379,7 +1473,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "break")) {
+	if (tok->keyword == KW_BREAK) {
 		if (brk_label == NULL) {
 			error_tok(tok, "stray break");
 		}
@@ -1389,7 +1483,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "continue")) {
+	if (tok->keyword == KW_CONTINUE) {
 		if (cont_label == NULL) {
 			error_tok(tok, "stray continue");
 		}
@@ -1399,10 +1493,9 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (tok->kind == TK_IDENT && equal(tok->next, ":")) {
+	if (tok->kind == TK_IDENT && tok->next->punct == ':') {
 		Node *node = new_node(ND_LABEL, tok);
-		node->label = calloc(tok->len + 1, sizeof(char));
-		strncpy(node->label, tok->loc, tok->len);
+		node->label = tok->ident;
 		node->unique_label = new_unique_name();
 		node->lhs = stmt(rest, tok->next->next);
 		node->goto_next = labels;
@@ -1410,7 +1503,7 @@ Node *stmt(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "{")) {
+	if (tok->punct == '{') {
 		return compound_stmt(rest, tok->next);
 	}
 
@@ -1421,16 +1514,16 @@ Node *stmt(Token **rest, Token *tok) {
 Node *compound_stmt(Token **rest, Token *tok) {
 	Node *node = new_node(ND_BLOCK, tok);
 
-	Node *head = calloc(1, sizeof(Node));
+	Node *head = arena_alloc(ast_arena, sizeof(Node));
 	Node *cur = head;
 
 	enter_scope();
 
 	VarAttr *attr;
 	Type *basety;
-	while (!equal(tok, "}")) {
-		if (is_typename(tok) && !equal(tok->next, ":")) {
-			attr = calloc(1, sizeof(VarAttr));
+	while (tok->punct != '}') {
+		if (is_typename(tok) && tok->next->punct != ':') {
+			attr = arena_alloc(scratch_arena, sizeof(VarAttr));
 			basety = declspec(&tok, tok, attr);
 
 			if (attr->is_typedef) {
@@ -1465,7 +1558,7 @@ Node *compound_stmt(Token **rest, Token *tok) {
 
 // expr-stmt = expr? ";"
 Node *expr_stmt(Token **rest, Token *tok) {
-	if (equal(tok, ";")) {
+	if (tok->punct == ';') {
 		// Null statement
 		*rest = tok->next;
 		return new_node(ND_BLOCK, tok);
@@ -1481,7 +1574,7 @@ Node *expr_stmt(Token **rest, Token *tok) {
 Node *expr(Token **rest, Token *tok) {
 	Node *node = assign(&tok, tok);
 
-	if (equal(tok, ",")) {
+	if (tok->punct == ',') {
 		return new_binary(ND_COMMA, node, expr(rest, tok->next), tok);
 	}
 
@@ -1552,7 +1645,7 @@ int32_t eval2(Node *node, Obj **var) {
 	} else if (node->kind == ND_LE) {
 		if (node->lhs->ty->is_unsigned) {
 			uint32_t lhs = eval(node->lhs);
-			return lhs < eval(node->rhs);
+			return lhs <= eval(node->rhs);
 		} else {
 			return eval(node->lhs) <= eval(node->rhs);
 		}
@@ -1585,11 +1678,20 @@ int32_t eval2(Node *node, Obj **var) {
 		return FALSE;
 	} else if (node->kind == ND_CAST) {
 		int32_t val = eval2(node->lhs, var);
+		if (node->ty->kind == TY_BOOL) {
+			return val != 0;
+		}
 		if (is_integer(node->ty)) {
 			if (node->ty->size == 1) {
-				return val & 0xff;
+				val = val & 0xff;
+				if (!node->ty->is_unsigned && val >= 0x80) {
+					val -= 0x100;
+				}
 			} else if (node->ty->size == 2) {
-				return val & 0xffff;
+				val = val & 0xffff;
+				if (!node->ty->is_unsigned && val >= 0x8000) {
+					val -= 0x10000;
+				}
 			}
 		}
 		return val;
@@ -1640,22 +1742,68 @@ int32_t const_expr(Token **rest, Token *tok) {
 	return eval(node);
 }
 
-// Convert `A op= B` to `tmp = &A, *tmp = *tmp op B` where tmp is a
-// fresh pointer variable.
+// Returns true if evaluating the address of a given lvalue twice is both
+// cheap and free of side effects.
+int is_simple_lvalue(Node *node) {
+	if (node->kind == ND_VAR) {
+		return TRUE;
+	}
+	if (node->kind == ND_MEMBER) {
+		return is_simple_lvalue(node->lhs);
+	}
+	if (node->kind == ND_DEREF) {
+		return node->lhs->kind == ND_VAR;
+	}
+	return FALSE;
+}
+
+// Returns the hidden pointer variable used by compound assignments at the
+// current nesting depth, creating it if needed. The variable is shared by
+// all compound assignments at that depth in the current function; one
+// nested in the right-hand side of another is one level deeper, so it
+// cannot overwrite the outer address while it is still needed.
+Obj *assign_tmp(void) {
+	AssignTmp *tmp = assign_tmps;
+	AssignTmp *prev = NULL;
+	int i;
+	for (i = 0; i <= assign_depth; i += 1) {
+		if (tmp == NULL) {
+			tmp = arena_alloc(ast_arena, sizeof(AssignTmp));
+			tmp->var = new_lvar("", pointer_to(ty_void));
+			if (prev == NULL) {
+				assign_tmps = tmp;
+			} else {
+				prev->next = tmp;
+			}
+		}
+		prev = tmp;
+		tmp = tmp->next;
+	}
+	return prev->var;
+}
+
+// Convert `A op= B` to `A = A op B` if A is a simple lvalue. Otherwise,
+// convert it to `tmp = &A, *tmp = *tmp op B` where tmp is a hidden pointer
+// variable, so that A is evaluated only once.
 Node *to_assign(Node *binary) {
 	add_type(binary->lhs);
 	add_type(binary->rhs);
 	Token *tok = binary->tok;
 
-	Obj *var = new_lvar("", pointer_to(binary->lhs->ty));
+	if (is_simple_lvalue(binary->lhs)) {
+		return new_binary(ND_ASSIGN, binary->lhs, binary, tok);
+	}
+
+	Obj *var = assign_tmp();
+	Type *ptr_ty = pointer_to(binary->lhs->ty);
 
 	Node *expr1 = new_binary(ND_ASSIGN, new_var_node(var, tok),
 			new_unary(ND_ADDR, binary->lhs, tok), tok);
 
 	Node *expr2 = new_binary(ND_ASSIGN,
-			new_unary(ND_DEREF, new_var_node(var, tok), tok),
+			new_unary(ND_DEREF, new_cast(new_var_node(var, tok), ptr_ty), tok),
 			new_binary(binary->kind,
-				new_unary(ND_DEREF, new_var_node(var, tok), tok),
+				new_unary(ND_DEREF, new_cast(new_var_node(var, tok), ptr_ty), tok),
 				binary->rhs,
 				tok),
 			tok);
@@ -1663,54 +1811,55 @@ Node *to_assign(Node *binary) {
 	return new_binary(ND_COMMA, expr1, expr2, tok);
 }
 
+// Returns the kind of the binary operator of a compound assignment
+// operator, or -1 if the punctuator is not one.
+int assign_op_kind(int punct) {
+	if (punct == PU_ADD_ASSIGN) {
+		return ND_ADD;
+	} else if (punct == PU_SUB_ASSIGN) {
+		return ND_SUB;
+	} else if (punct == PU_MUL_ASSIGN) {
+		return ND_MUL;
+	} else if (punct == PU_DIV_ASSIGN) {
+		return ND_DIV;
+	} else if (punct == PU_MOD_ASSIGN) {
+		return ND_MOD;
+	} else if (punct == PU_AND_ASSIGN) {
+		return ND_BITAND;
+	} else if (punct == PU_OR_ASSIGN) {
+		return ND_BITOR;
+	} else if (punct == PU_XOR_ASSIGN) {
+		return ND_BITXOR;
+	} else if (punct == PU_SHL_ASSIGN) {
+		return ND_SHL;
+	} else if (punct == PU_SHR_ASSIGN) {
+		return ND_SHR;
+	}
+	return -1;
+}
+
 // assign    = conditional (assign-op assign)?
 // assign-op = "=" | "+=" | "-=" | "*=" | "/=" | "%=" | "&=" | "|=" | "^="
 //           | "<<=" | ">>="
 Node *assign(Token **rest, Token *tok) {
 	Node *node = conditional(&tok, tok);
 
-	if (equal(tok, "=")) {
+	if (tok->punct == '=') {
 		return new_binary(ND_ASSIGN, node, assign(rest, tok->next), tok);
 	}
 
-	if (equal(tok, "+=")) {
-		return to_assign(new_add(node, assign(rest, tok->next), tok));
-	}
+	int kind = assign_op_kind(tok->punct);
+	if (kind != -1) {
+		assign_depth += 1;
+		Node *rhs = assign(rest, tok->next);
+		assign_depth -= 1;
 
-	if (equal(tok, "-=")) {
-		return to_assign(new_sub(node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "*=")) {
-		return to_assign(new_binary(ND_MUL, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "/=")) {
-		return to_assign(new_binary(ND_DIV, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "%=")) {
-		return to_assign(new_binary(ND_MOD, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "&=")) {
-		return to_assign(new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "|=")) {
-		return to_assign(new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "^=")) {
-		return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, "<<=")) {
-		return to_assign(new_binary(ND_SHL, node, assign(rest, tok->next), tok));
-	}
-
-	if (equal(tok, ">>=")) {
-		return to_assign(new_binary(ND_SHR, node, assign(rest, tok->next), tok));
+		if (kind == ND_ADD) {
+			return to_assign(new_add(node, rhs, tok));
+		} else if (kind == ND_SUB) {
+			return to_assign(new_sub(node, rhs, tok));
+		}
+		return to_assign(new_binary(kind, node, rhs, tok));
 	}
 
 	*rest = tok;
@@ -1721,7 +1870,7 @@ Node *assign(Token **rest, Token *tok) {
 Node *conditional(Token **rest, Token *tok) {
 	Node *cond = logor(&tok, tok);
 
-	if (!equal(tok, "?")) {
+	if (tok->punct != '?') {
 		*rest = tok;
 		return cond;
 	}
@@ -1738,7 +1887,7 @@ Node *conditional(Token **rest, Token *tok) {
 Node *logor(Token **rest, Token *tok) {
 	Node *node = logand(&tok, tok);
 	Token *start;
-	while (equal(tok, "||")) {
+	while (tok->punct == PU_LOGOR) {
 		start = tok;
 		node = new_binary(ND_LOGOR, node, logand(&tok, tok->next), start);
 	}
@@ -1750,7 +1899,7 @@ Node *logor(Token **rest, Token *tok) {
 Node *logand(Token **rest, Token *tok) {
 	Node *node = bitor(&tok, tok);
 	Token *start;
-	while (equal(tok, "&&")) {
+	while (tok->punct == PU_LOGAND) {
 		start = tok;
 		node = new_binary(ND_LOGAND, node, bitor(&tok, tok->next), start);
 	}
@@ -1762,7 +1911,7 @@ Node *logand(Token **rest, Token *tok) {
 Node *bitor(Token **rest, Token *tok) {
 	Node *node = bitxor(&tok, tok);
 	Token *start;
-	while (equal(tok, "|")) {
+	while (tok->punct == '|') {
 		start = tok;
 		node = new_binary(ND_BITOR, node, bitxor(&tok, tok->next), start);
 	}
@@ -1774,7 +1923,7 @@ Node *bitor(Token **rest, Token *tok) {
 Node *bitxor(Token **rest, Token *tok) {
 	Node *node = bitand(&tok, tok);
 	Token *start;
-	while (equal(tok, "^")) {
+	while (tok->punct == '^') {
 		start = tok;
 		node = new_binary(ND_BITXOR, node, bitand(&tok, tok->next), start);
 	}
@@ -1786,7 +1935,7 @@ Node *bitxor(Token **rest, Token *tok) {
 Node *bitand(Token **rest, Token *tok) {
 	Node *node = equality(&tok, tok);
 	Token *start;
-	while (equal(tok, "&")) {
+	while (tok->punct == '&') {
 		start = tok;
 		node = new_binary(ND_BITAND, node, equality(&tok, tok->next), start);
 	}
@@ -1801,12 +1950,12 @@ Node *equality(Token **rest, Token *tok) {
 	Token *start;
 	while (1) {
 		start = tok;
-		if (equal(tok, "==")) {
+		if (tok->punct == PU_EQ) {
 			node = new_binary(ND_EQ, node, relational(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, "!=")) {
+		if (tok->punct == PU_NE) {
 			node = new_binary(ND_NE, node, relational(&tok, tok->next), start);
 			continue;
 		}
@@ -1823,22 +1972,22 @@ Node *relational(Token **rest, Token *tok) {
 	Token *start;
 	while (1) {
 		start = tok;
-		if (equal(tok, "<")) {
+		if (tok->punct == '<') {
 			node = new_binary(ND_LT, node, shift(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, "<=")) {
+		if (tok->punct == PU_LE) {
 			node = new_binary(ND_LE, node, shift(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, ">")) {
+		if (tok->punct == '>') {
 			node = new_binary(ND_LT, shift(&tok, tok->next), node, start);
 			continue;
 		}
 
-		if (equal(tok, ">=")) {
+		if (tok->punct == PU_GE) {
 			node = new_binary(ND_LE, shift(&tok, tok->next), node, start);
 			continue;
 		}
@@ -1856,12 +2005,12 @@ Node *shift(Token **rest, Token *tok) {
 	while (1) {
 		start = tok;
 
-		if (equal(tok, "<<")) {
+		if (tok->punct == PU_SHL) {
 			node = new_binary(ND_SHL, node, add(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, ">>")) {
+		if (tok->punct == PU_SHR) {
 			node = new_binary(ND_SHR, node, add(&tok, tok->next), start);
 			continue;
 		}
@@ -1942,12 +2091,12 @@ Node *add(Token **rest, Token *tok) {
 	Token *start;
 	while (1) {
 		start = tok;
-		if (equal(tok, "+")) {
+		if (tok->punct == '+') {
 			node = new_add(node, mul(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, "-")) {
+		if (tok->punct == '-') {
 			node = new_sub(node, mul(&tok, tok->next), start);
 			continue;
 		}
@@ -1964,17 +2113,17 @@ Node *mul(Token **rest, Token *tok) {
 	Token *start;
 	while (1) {
 		start = tok;
-		if (equal(tok, "*")) {
+		if (tok->punct == '*') {
 			node = new_binary(ND_MUL, node, cast(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, "/")) {
+		if (tok->punct == '/') {
 			node = new_binary(ND_DIV, node, cast(&tok, tok->next), start);
 			continue;
 		}
 
-		if (equal(tok, "%")) {
+		if (tok->punct == '%') {
 			node = new_binary(ND_MOD, node, cast(&tok, tok->next), start);
 			continue;
 		}
@@ -1986,13 +2135,13 @@ Node *mul(Token **rest, Token *tok) {
 
 // cast = "(" type-nmae ")" cast | unary
 Node *cast(Token **rest, Token *tok) {
-	if (equal(tok, "(") && is_typename(tok->next)) {
+	if (tok->punct == '(' && is_typename(tok->next)) {
 		Token *start = tok;
 		Type *ty = typename(&tok, tok->next);
 		tok = skip(tok, ")");
 
 		// compound literal
-		if (equal(tok, "{")) {
+		if (tok->punct == '{') {
 			return unary(rest, start);
 		}
 
@@ -2009,37 +2158,37 @@ Node *cast(Token **rest, Token *tok) {
 //       | ("++" | "--") unary
 //       | postfix
 Node *unary(Token **rest, Token *tok) {
-	if (equal(tok, "+")) {
+	if (tok->punct == '+') {
 		return cast(rest, tok->next);
 	}
 
-	if (equal(tok, "-")) {
+	if (tok->punct == '-') {
 		return new_unary(ND_NEG, cast(rest, tok->next), tok);
 	}
 
-	if (equal(tok, "&")) {
+	if (tok->punct == '&') {
 		return new_unary(ND_ADDR, cast(rest, tok->next), tok);
 	}
 
-	if (equal(tok, "*")) {
+	if (tok->punct == '*') {
 		return new_unary(ND_DEREF, cast(rest, tok->next), tok);
 	}
 
-	if (equal(tok, "!")) {
+	if (tok->punct == '!') {
 		return new_unary(ND_NOT, cast(rest, tok->next), tok);
 	}
 
-	if (equal(tok, "~")) {
+	if (tok->punct == '~') {
 		return new_unary(ND_BITNOT, cast(rest, tok->next), tok);
 	}
 
 	// Read ++i as i+=1
-	if (equal(tok, "++")) {
+	if (tok->punct == PU_INC) {
 		return to_assign(new_add(unary(rest, tok->next), new_num(1, tok), tok));
 	}
 
 	// Read --i as i-=1
-	if (equal(tok, "--")) {
+	if (tok->punct == PU_DEC) {
 		return to_assign(new_sub(unary(rest, tok->next), new_num(1, tok), tok));
 	}
 
@@ -2048,7 +2197,7 @@ Node *unary(Token **rest, Token *tok) {
 
 // struct-members = (declspec declarator ("," declarator)* ";")*
 void struct_members(Token **rest, Token *tok, Type *ty) {
-	Member *head = calloc(1, sizeof(Member));
+	Member *head = arena_alloc(ast_arena, sizeof(Member));
 	Member *cur = head;
 	int idx = 0;
 
@@ -2056,9 +2205,9 @@ void struct_members(Token **rest, Token *tok, Type *ty) {
 	Member *mem;
 	VarAttr *attr;
 	int first;
-	while (!equal(tok, "}")) {
+	while (tok->punct != '}') {
 		first = TRUE;
-		attr = calloc(1, sizeof(VarAttr));
+		attr = arena_alloc(scratch_arena, sizeof(VarAttr));
 		basety = declspec(&tok, tok, attr);
 
 		while (!consume(&tok, tok, ";")) {
@@ -2067,7 +2216,7 @@ void struct_members(Token **rest, Token *tok, Type *ty) {
 			}
 			first = FALSE;
 
-			mem = calloc(1, sizeof(Member));
+			mem = arena_alloc(ast_arena, sizeof(Member));
 			mem->ty = declarator(&tok, tok, basety);
 			mem->name = mem->ty->name;
 			mem->idx = idx;
@@ -2104,7 +2253,7 @@ Type *struct_union_decl(Token **rest, Token *tok) {
 		tok = tok->next;
 	}
 
-	if (tag != NULL && !equal(tok, "{")) {
+	if (tag != NULL && tok->punct != '{') {
 		*rest = tok;
 
 		Type *ty = find_tag(tag);
@@ -2127,12 +2276,13 @@ Type *struct_union_decl(Token **rest, Token *tok) {
 	if (tag != NULL) {
 		// If this is a redefinition, overwrite the previous type; otherwise,
 		// register the struct type.
-		TagScope *sc;
-		for (sc = scope->tags; sc; sc = sc->next) {
-			if (equal(tag, sc->name)) {
-				memcpy(sc->ty, ty, sizeof(Type));
-				return sc->ty;
-			}
+		TagScope *sc = find_tag_scope(tag);
+		if (sc != NULL && sc->depth == scope->depth) {
+			// Pointers to the incomplete type stay valid, but arrays of it
+			// were sized before it was complete and must be recreated.
+			ty->pointer_cache = sc->ty->pointer_cache;
+			memcpy(sc->ty, ty, sizeof(Type));
+			return sc->ty;
 		}
 
 		push_tag_scope(tag, ty);
@@ -2192,8 +2342,7 @@ Type *union_decl(Token **rest, Token *tok) {
 Member *get_struct_member(Type *ty, Token *tok) {
 	Member *mem;
 	for (mem = ty->members; mem; mem = mem->next) {
-		if (mem->name->len == tok->len &&
-				!strncmp(mem->name->loc, tok->loc, tok->len)) {
+		if (mem->name->ident == tok->ident) {
 			return mem;
 		}
 	}
@@ -2222,7 +2371,7 @@ Node *new_inc_dec(Node *node, Token *tok, int addend) {
 //         | primary ("[" expr "]" | "." ident | "->" ident | "++" | "--")*
 Node *postfix(Token **rest, Token *tok) {
 	// Compound literal handling
-	if (equal(tok, "(") && is_typename(tok->next)) {
+	if (tok->punct == '(' && is_typename(tok->next)) {
 		Token *start = tok;
 		Type *ty = typename(&tok, tok->next);
 		tok = skip(tok, ")");
@@ -2244,7 +2393,7 @@ Node *postfix(Token **rest, Token *tok) {
 	Token *start;
 	Node *idx;
 	while (1) {
-		if (equal(tok, "[")) {
+		if (tok->punct == '[') {
 			// x[y] => *(x+y)
 			start = tok;
 			idx = expr(&tok, tok->next);
@@ -2253,13 +2402,13 @@ Node *postfix(Token **rest, Token *tok) {
 			continue;
 		}
 
-		if (equal(tok, ".")) {
+		if (tok->punct == '.') {
 			node = struct_ref(node, tok->next);
 			tok = tok->next->next;
 			continue;
 		}
 
-		if (equal(tok, "->")) {
+		if (tok->punct == PU_ARROW) {
 			// x->y => (*x).y
 			node = new_unary(ND_DEREF, node, tok);
 			node = struct_ref(node, tok->next);
@@ -2267,13 +2416,13 @@ Node *postfix(Token **rest, Token *tok) {
 			continue;
 		}
 
-		if (equal(tok, "++")) {
+		if (tok->punct == PU_INC) {
 			node = new_inc_dec(node, tok, 1);
 			tok = tok->next;
 			continue;
 		}
 
-		if (equal(tok, "--")) {
+		if (tok->punct == PU_DEC) {
 			node = new_inc_dec(node, tok, -1);
 			tok = tok->next;
 			continue;
@@ -2300,11 +2449,11 @@ Node *funcall(Token **rest, Token *tok) {
 	Type *ty = sc->var->ty;
 	Type *param_ty = ty->params;
 
-	Node *head = calloc(1, sizeof(Node));
+	Node *head = arena_alloc(ast_arena, sizeof(Node));
 	Node *cur = head;
 
 	Node *arg;
-	while (!equal(tok, ")")) {
+	while (tok->punct != ')') {
 		if (cur != head) {
 			tok = skip(tok, ",");
 		}
@@ -2333,8 +2482,7 @@ Node *funcall(Token **rest, Token *tok) {
 	*rest = skip(tok, ")");
 
 	Node *node = new_node(ND_FUNCALL, start);
-	node->funcname = calloc(start->len + 1, sizeof(char));
-	strncpy(node->funcname, start->loc, start->len);
+	node->funcname = start->ident;
 	node->func_ty = ty;
 	node->ty = ty->return_ty;
 	node->args = head->next;
@@ -2354,7 +2502,7 @@ Node *funcall(Token **rest, Token *tok) {
 Node *primary(Token **rest, Token *tok) {
 	Token *start = tok;
 
-	if (equal(tok, "(") && equal(tok->next, "{")) {
+	if (tok->punct == '(' && tok->next->punct == '{') {
 		// This is a GNU statement expression.
 		Node *node = new_node(ND_STMT_EXPR, tok);
 		Node *stmt = compound_stmt(&tok, tok->next->next);
@@ -2363,38 +2511,38 @@ Node *primary(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "(")) {
+	if (tok->punct == '(') {
 		Node *node = expr(&tok, tok->next);
 		*rest = skip(tok, ")");
 		return node;
 	}
 
-	if (equal(tok, "sizeof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
+	if (tok->keyword == KW_SIZEOF && tok->next->punct == '(' && is_typename(tok->next->next)) {
 		Type *ty = typename(&tok, tok->next->next);
 		*rest = skip(tok, ")");
 		return new_ulong(ty->size, start);
 	}
 
-	if (equal(tok, "sizeof")) {
+	if (tok->keyword == KW_SIZEOF) {
 		Node *node = unary(rest, tok->next);
 		add_type(node);
 		return new_ulong(node->ty->size, tok);
 	}
 
-	if (equal(tok, "_TEST_ASSERT")) {
+	if (tok->keyword == KW_TEST_ASSERT) {
 		Token *orig_tok = tok;
 		tok = skip(tok->next, "(");
 		Node *expected = assign(&tok, tok);
 		Node *eval = assign(&tok, tok->next);
 
 		int code_length = tok->loc - eval->tok->loc;
-		char *code = calloc(code_length + 1, sizeof(char));
+		char *code = arena_alloc(ast_arena, code_length + 1);
 		strncpy(code, eval->tok->loc, code_length);
 		Obj *code_str = new_string_literal(code, array_of(ty_char, code_length + 1));
 		Node *code_node = new_var_node(code_str, orig_tok);
 
 		Node *node = new_node(ND_FUNCALL, orig_tok);
-		node->funcname = "_assert_failed";
+		node->funcname = intern("_assert_failed", 14);
 		node->args = expected;
 		node->args->next = eval;
 		node->args->next->next = code_node;
@@ -2403,13 +2551,13 @@ Node *primary(Token **rest, Token *tok) {
 		return node;
 	}
 
-	if (equal(tok, "_Alignof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
+	if (tok->keyword == KW_ALIGNOF && tok->next->punct == '(' && is_typename(tok->next->next)) {
 		Type *ty = typename(&tok, tok->next->next);
 		*rest = skip(tok, ")");
 		return new_ulong(ty->align, tok);
 	}
 
-	if (equal(tok, "_Alignof")) {
+	if (tok->keyword == KW_ALIGNOF) {
 		Node *node = unary(rest, tok->next);
 		add_type(node);
 		return new_ulong(node->ty->align, tok);
@@ -2417,7 +2565,7 @@ Node *primary(Token **rest, Token *tok) {
 
 	if (tok->kind == TK_IDENT) {
 		// Function call
-		if (equal(tok->next, "(")) {
+		if (tok->next->punct == '(') {
 			return funcall(rest, tok);
 		}
 
@@ -2499,7 +2647,7 @@ void resolve_goto_labels(void) {
 	Node *y;
 	for (x = gotos; x; x = x->goto_next) {
 		for (y = labels; y; y = y->goto_next) {
-			if (!strcmp(x->label, y->label)) {
+			if (x->label == y->label) {
 				x->unique_label = y->unique_label;
 				break;
 			}
@@ -2531,6 +2679,7 @@ Token *function(Token *tok, Type *basety, VarAttr *attr) {
 
 	parsing_fn = fn;
 	locals = NULL;
+	assign_tmps = NULL;
 	enter_scope();
 	create_param_lvars(ty->params);
 	fn->params = locals;
@@ -2560,13 +2709,14 @@ Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
 		}
 
 		var = new_gvar(get_ident(ty->name), ty);
+		var->tok = ty->name;
 		var->is_definition = !attr->is_extern;
 		var->is_static = attr->is_static;
 		if (attr->align != 0) {
 			var->align = attr->align;
 		}
 
-		if (equal(tok, "=")) {
+		if (tok->punct == '=') {
 			gvar_initializer(&tok, tok->next, var);
 		}
 	}
@@ -2577,11 +2727,11 @@ Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
 // Lookahead tokens, returning true if a given token is the start of a
 // function definition or declaration.
 int is_function(Token *tok) {
-	if (equal(tok, ";")) {
+	if (tok->punct == ';') {
 		return FALSE;
 	}
 
-	Type *dummy = calloc(1, sizeof(Type));
+	Type *dummy = arena_alloc(scratch_arena, sizeof(Type));
 	Type *ty = declarator(&tok, tok, dummy);
 	return ty->kind == TY_FUNC;
 }
@@ -2589,14 +2739,20 @@ int is_function(Token *tok) {
 // program = (typedef | function-definition | global-variable)*
 Obj *parse(Token *tok) {
 	// Setup scope
-	scope = calloc(1, sizeof(Scope));
+	scope = arena_alloc(ast_arena, sizeof(Scope));
+	var_table = calloc(SCOPE_TABLE_SIZE, sizeof(VarScope*));
+	tag_table = calloc(SCOPE_TABLE_SIZE, sizeof(TagScope*));
 
 	globals = NULL;
 
 	Type *basety;
 	VarAttr *attr;
 	while (tok->kind != TK_EOF) {
-		attr = calloc(1, sizeof(VarAttr));
+		// Nothing allocated while looking ahead in the previous declaration
+		// is referenced any more.
+		arena_reset(scratch_arena);
+
+		attr = arena_alloc(scratch_arena, sizeof(VarAttr));
 		basety = declspec(&tok, tok, attr);
 
 		// Typedef
@@ -0,0 +1,370 @@
+// Peephole optimiser over the emitted M1 instruction stream.
+//
+// The lines of each function are collected in a list, rewritten with a
+// table of patterns matched over a sliding window, and then written out.
+//
+// In a pattern, "$a" to "$z" match a register name and must be bound
+// consistently across the window, and "$A" to "$Z" match any text up to
+// the next character of the pattern.
+#include "chibicc.h"
+
+struct AsmLine {
+	struct AsmLine *next;
+	struct AsmLine *prev;
+	char *text;
+	int is_label;
+};
+typedef struct AsmLine AsmLine;
+
+struct PeepholeRule {
+	struct PeepholeRule *next;
+	char **pat;  // Lines to match
+	int npat;
+	char **rep;  // Lines to replace them with
+	int nrep;
+};
+typedef struct PeepholeRule PeepholeRule;
+
+AsmLine *asm_head;
+AsmLine *asm_tail;
+
+PeepholeRule *peephole_rules;
+int max_window;
+
+// Variable bindings of the pattern being matched, indexed by name
+char **bind_start;
+int *bind_len;
+
+char *subst_buf;
+
+AsmLine *new_asm_line(char *text) {
+	AsmLine *line = arena_alloc(scratch_arena, sizeof(AsmLine));
+	line->text = text;
+	line->is_label = text[0] == ':';
+	return line;
+}
+
+void peephole_add(char *text) {
+	int len = strlen(text);
+	char *copy = arena_alloc(scratch_arena, len + 1);
+	memcpy(copy, text, len);
+
+	AsmLine *line = new_asm_line(copy);
+	line->prev = asm_tail;
+	if (asm_tail) {
+		asm_tail->next = line;
+	} else {
+		asm_head = line;
+	}
+	asm_tail = line;
+}
+
+void remove_asm_line(AsmLine *line) {
+	if (line->prev) {
+		line->prev->next = line->next;
+	} else {
+		asm_head = line->next;
+	}
+	if (line->next) {
+		line->next->prev = line->prev;
+	} else {
+		asm_tail = line->prev;
+	}
+}
+
+void insert_asm_line(AsmLine *after, AsmLine *line) {
+	line->prev = after;
+	if (after) {
+		line->next = after->next;
+		after->next = line;
+	} else {
+		line->next = asm_head;
+		asm_head = line;
+	}
+	if (line->next) {
+		line->next->prev = line;
+	} else {
+		asm_tail = line;
+	}
+}
+
+int count_lines(char *s) {
+	if (s[0] == '\0') {
+		return 0;
+	}
+	int count = 1;
+	int i;
+	for (i = 0; s[i] != '\0'; i += 1) {
+		if (s[i] == '\n') {
+			count += 1;
+		}
+	}
+	return count;
+}
+
+// Split "a\nb\nc" into an array of n lines.
+char **split_lines(char *s, int n) {
+	char **lines = calloc(n + 1, sizeof(char *));
+	int k = 0;
+	int start = 0;
+	int i;
+	char *line;
+	for (i = 0; k < n; i += 1) {
+		if (s[i] == '\n' || s[i] == '\0') {
+			line = calloc(i - start + 1, sizeof(char));
+			memcpy(line, s + start, i - start);
+			lines[k] = line;
+			k += 1;
+			start = i + 1;
+		}
+	}
+	return lines;
+}
+
+void add_rule(char *pat, char *rep) {
+	PeepholeRule *rule = calloc(1, sizeof(PeepholeRule));
+	rule->npat = count_lines(pat);
+	rule->pat = split_lines(pat, rule->npat);
+	rule->nrep = count_lines(rep);
+	rule->rep = split_lines(rep, rule->nrep);
+	if (rule->npat > max_window) {
+		max_window = rule->npat;
+	}
+
+	// Keep the rules in the order they were added
+	PeepholeRule *last = peephole_rules;
+	if (!last) {
+		peephole_rules = rule;
+		return;
+	}
+	while (last->next) {
+		last = last->next;
+	}
+	last->next = rule;
+}
+
+void init_peephole_rules(void) {
+	bind_start = calloc(128, sizeof(char *));
+	bind_len = calloc(128, sizeof(int));
+	subst_buf = calloc(MAX_STRING, sizeof(char));
+
+	// Values passed through the stack
+	add_rule("push_$a\npop_$a", "");
+	add_rule("push_$a\npop_$b", "mov_$b,$a");
+	// Register copies
+	add_rule("mov_$a,$a", "");
+	add_rule("mov_$a,$b\nmov_$b,$a", "mov_$a,$b");
+	// Constants that are overwritten or unused
+	add_rule("mov_$a, $X\nmov_$a, $Y", "mov_$a, $Y");
+	add_rule("mov_eax, %0\ncall $F", "call $F");
+	add_rule("add_$a, %0", "");
+	add_rule("sub_$a, %0", "");
+	// Reloading a value just stored to the frame
+	add_rule("mov_[ebp+DWORD],$a %$N\nmov_$a,[ebp+DWORD] %$N", "mov_[ebp+DWORD],$a %$N");
+	// Jumps to the next line
+	add_rule("j$c %$L\n:$L", ":$L");
+}
+
+int is_register_char(int c) {
+	return c >= 'a' && c <= 'z';
+}
+
+int match_line(char *pat, char *s) {
+	int i = 0;
+	int j = 0;
+	int c;
+	int start;
+	int k;
+	while (pat[i] != '\0') {
+		if (pat[i] != '$') {
+			if (pat[i] != s[j]) {
+				return FALSE;
+			}
+			i += 1;
+			j += 1;
+			continue;
+		}
+
+		c = pat[i + 1];
+		start = j;
+		if (is_register_char(c)) {
+			while (is_register_char(s[j])) {
+				j += 1;
+			}
+		} else {
+			while (s[j] != '\0' && s[j] != pat[i + 2]) {
+				j += 1;
+			}
+		}
+		if (j == start) {
+			return FALSE;
+		}
+
+		if (bind_start[c]) {
+			if (bind_len[c] != j - start) {
+				return FALSE;
+			}
+			for (k = 0; k < bind_len[c]; k += 1) {
+				if (bind_start[c][k] != s[start + k]) {
+					return FALSE;
+				}
+			}
+		} else {
+			bind_start[c] = s + start;
+			bind_len[c] = j - start;
+		}
+		i += 2;
+	}
+	return s[j] == '\0';
+}
+
+void clear_bindings(void) {
+	int c;
+	for (c = 'A'; c <= 'z'; c += 1) {
+		bind_start[c] = NULL;
+	}
+}
+
+int match_rule(PeepholeRule *rule, AsmLine *line) {
+	clear_bindings();
+	int i;
+	for (i = 0; i < rule->npat; i += 1) {
+		if (!line) {
+			return FALSE;
+		}
+		if (!match_line(rule->pat[i], line->text)) {
+			return FALSE;
+		}
+		line = line->next;
+	}
+	return TRUE;
+}
+
+char *substitute(char *pat) {
+	char *buf = subst_buf;
+	int i = 0;
+	int j = 0;
+	int c;
+	int k;
+	while (pat[i] != '\0') {
+		if (pat[i] != '$') {
+			buf[j] = pat[i];
+			i += 1;
+			j += 1;
+			continue;
+		}
+		c = pat[i + 1];
+		for (k = 0; k < bind_len[c]; k += 1) {
+			buf[j] = bind_start[c][k];
+			j += 1;
+		}
+		i += 2;
+	}
+
+	char *text = arena_alloc(scratch_arena, j + 1);
+	memcpy(text, buf, j);
+	return text;
+}
+
+// Replace the lines matched by rule, starting at line. Returns the line
+// before the replacement.
+AsmLine *apply_rule(PeepholeRule *rule, AsmLine *line) {
+	AsmLine *before = line->prev;
+
+	// Build the replacement before unlinking, while the bindings still
+	// point into the matched lines.
+	AsmLine *first = NULL;
+	AsmLine *last = NULL;
+	AsmLine *new_line;
+	int i;
+	for (i = 0; i < rule->nrep; i += 1) {
+		new_line = new_asm_line(substitute(rule->rep[i]));
+		if (last) {
+			last->next = new_line;
+			new_line->prev = last;
+		} else {
+			first = new_line;
+		}
+		last = new_line;
+	}
+
+	AsmLine *next;
+	for (i = 0; i < rule->npat; i += 1) {
+		next = line->next;
+		remove_asm_line(line);
+		line = next;
+	}
+
+	AsmLine *at = before;
+	while (first) {
+		next = first->next;
+		insert_asm_line(at, first);
+		at = first;
+		first = next;
+	}
+	return before;
+}
+
+int is_unconditional_jump(AsmLine *line) {
+	if (!strcmp(line->text, "ret") || !strcmp(line->text, "jmp_eax")) {
+		return TRUE;
+	}
+	return startswith(line->text, "jmp %");
+}
+
+void run_peephole(void) {
+	AsmLine *line = asm_head;
+	AsmLine *prev;
+	PeepholeRule *rule;
+	int i;
+	while (line) {
+		// Code after an unconditional jump is unreachable until the next
+		// label.
+		prev = line->prev;
+		if (!line->is_label && prev && is_unconditional_jump(prev)) {
+			remove_asm_line(line);
+			line = prev->next;
+			continue;
+		}
+
+		for (rule = peephole_rules; rule; rule = rule->next) {
+			if (match_rule(rule, line)) {
+				break;
+			}
+		}
+		if (!rule) {
+			line = line->next;
+			continue;
+		}
+
+		// Step back so that the rewritten lines can match again together
+		// with the ones before them.
+		prev = apply_rule(rule, line);
+		for (i = 1; prev && i < max_window; i += 1) {
+			prev = prev->prev;
+		}
+		if (prev) {
+			line = prev;
+		} else {
+			line = asm_head;
+		}
+	}
+}
+
+// Optimise the buffered lines and write them to out.
+void peephole_flush(FILE *out) {
+	if (opt_fpeephole) {
+		if (!peephole_rules) {
+			init_peephole_rules();
+		}
+		run_peephole();
+	}
+
+	AsmLine *line;
+	for (line = asm_head; line; line = line->next) {
+		fputs(line->text, out);
+		fputc('\n', out);
+	}
+	asm_head = NULL;
+	asm_tail = NULL;
+}
@@ -39,6 +39,10 @@ int main() {
   _TEST_ASSERT(6, ({ int i=3; i*=2; }));
   _TEST_ASSERT(3, ({ int i=6; i/=2; i; }));
   _TEST_ASSERT(3, ({ int i=6; i/=2; }));
+  _TEST_ASSERT(15, ({ struct {int a; char b;} x; x.b=3; x.b*=5; x.b; }));
+  _TEST_ASSERT(-128, ({ char c[2]; c[0]=1; c[1]=127; int i=1; c[i]+=1; c[1]; }));
+  _TEST_ASSERT(9, ({ int a[2]; a[0]=1; a[1]=2; int i=0; a[i+1]+=a[i]+=6; a[1]; }));
+  _TEST_ASSERT(7, ({ int a[2]; a[0]=1; a[1]=2; int i=0; a[i+1]+=a[i]+=6; a[0]; }));
 
   _TEST_ASSERT(3, ({ int i=2; ++i; }));
   _TEST_ASSERT(2, ({ int a[3]; a[0]=0; a[1]=1; a[2]=2; int *p=a+1; ++*p; }));
@@ -124,6 +128,34 @@ int main() {
   _TEST_ASSERT(-20, ({ int x; int *p=&x; p-20-p; }));
   _TEST_ASSERT(1, ({ int x; int *p=&x; p-20-p<0; }));
 
+  _TEST_ASSERT(15, ({ int a=3; int b=5; int c=7; int d=2; a-(b-(c*d+a)); }));
+  _TEST_ASSERT(15, ({ int a=3; int b=5; int c=7; int d=2; (a^b)*(c-d)/(b+d-a-c+5); }));
+  _TEST_ASSERT(333, ({ int a=3; int b=-5; int c=7; int d=2; ((((((a+b)*(c-d))+((a-b)+(c^d)))*(((a-b)-(c*d))-((a^b)+(c+d))))+((((a-b)+(c^d))-((a+b)*(c-d)))+(((a^b)+(c+d))^((a-b)-(c*d)))))*(((((a-b)-(c*d))-((a^b)+(c+d)))-(((a*b)^(c-d))*((a+b)-(c+d))))-((((a^b)+(c+d))^((a-b)-(c*d)))+(((a+b)-(c+d))+((a*b)^(c-d)))))); }));
+  _TEST_ASSERT(-1, ({ int x=255; (char)x; }));
+  _TEST_ASSERT(255, ({ int x=-1; (unsigned char)x; }));
+  _TEST_ASSERT(-1, ({ int x=65535; (short)(x+0); }));
+  _TEST_ASSERT(65535, ({ int x=-1; (unsigned short)(x*1); }));
+  _TEST_ASSERT(-4, ({ int x=-16; x>>2; }));
+  _TEST_ASSERT(1073741820, ({ unsigned x=-16; x>>2; }));
+  _TEST_ASSERT(48, ({ int x=3; x<<4; }));
+  _TEST_ASSERT(12, ({ int x=3; int y=2; x<<y; }));
+  _TEST_ASSERT(10, ({ struct { char a; int b; } s[2]; int i=1; s[i].b=10; s[1].b; }));
+  _TEST_ASSERT(7, ({ int a[3]; int *p=a; int i=2; p[i]=7; *(a+2); }));
+
+  _TEST_ASSERT(-56, (char)200);
+  _TEST_ASSERT(200, (unsigned char)200);
+  _TEST_ASSERT(-1, (short)0xffff);
+  _TEST_ASSERT(1, (_Bool)2);
+  _TEST_ASSERT(1, 1u <= 1u);
+  _TEST_ASSERT(0, ({ unsigned char c=200; c+0 < -1; }));
+  _TEST_ASSERT(1, ({ int i=0; i++*0; i; }));
+  _TEST_ASSERT(24, ({ int x=3; x*4*2; }));
+  _TEST_ASSERT(7, ({ int x=7; x/1+0; }));
+  _TEST_ASSERT(10, ({ int x=4; x+1+2+3; }));
+  _TEST_ASSERT(6, ({ unsigned x=1; x*2*3; }));
+  _TEST_ASSERT(0, ({ int x=65536; x*256*256; }));
+  _TEST_ASSERT(4, ({ char c=1; c+1+2; }));
+
   _TEST_ASSERT(15, (char *)0xffffffffffffffff - (char *)0xfffffffffffffff0);
   _TEST_ASSERT(-15, (char *)0xfffffffffffffff0 - (char *)0xffffffffffffffff);
   _TEST_ASSERT(1, (void *)0xffffffffffff > (void *)0);
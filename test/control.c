@@ -7,6 +7,14 @@ int main() {
   _TEST_ASSERT(3, ({ int x; if (1-1) x=2; else x=3; x; }));
   _TEST_ASSERT(2, ({ int x; if (1) x=2; else x=3; x; }));
   _TEST_ASSERT(2, ({ int x; if (2-1) x=2; else x=3; x; }));
+  _TEST_ASSERT(1, ({ int x; if (-1 < 1) x=1; else x=2; x; }));
+  _TEST_ASSERT(2, ({ int x; if (-1 < 1u) x=1; else x=2; x; }));
+  _TEST_ASSERT(2, ({ int x; if (3 >= 4) x=1; else x=2; x; }));
+  _TEST_ASSERT(1, ({ int x; if (0 || (1 && !0)) x=1; else x=2; x; }));
+  _TEST_ASSERT(2, ({ int x; if (!(1 && 2 == 2) || 0) x=1; else x=2; x; }));
+  _TEST_ASSERT(3, ({ int i=0; int j=0; while (!(i>=5) && j<3) { i=i+1; j=j+1; } i; }));
+  _TEST_ASSERT(4, ({ int i=0; do i=i+1; while (i!=4 && (i<10 || 0)); i; }));
+  _TEST_ASSERT(5, ({ int x=3; x>2 && x<4 ? 5 : 6; }));
 
   _TEST_ASSERT(55, ({ int i=0; int j=0; for (i=0; i<=10; i=i+1) j=i+j; j; }));
 
@@ -62,9 +70,30 @@ int main() {
   _TEST_ASSERT(0, ({ int i=0; switch(3) { case 0: 0; case 1: 0; case 2: 0; i=2; } i; }));
 
   _TEST_ASSERT(3, ({ int i=0; switch(-1) { case 0xffffffff: i=3; break; } i; }));
+  _TEST_ASSERT(13, ({ int i=0; switch(3) { case 1:i=11;break; case 2:i=12;break; case 3:i=13;break; case 5:i=15;break; case 6:i=16;break; } i; }));
+  _TEST_ASSERT(9, ({ int i=0; switch(4) { case 1:i=11;break; case 2:i=12;break; case 3:i=13;break; case 5:i=15;break; default:i=9; } i; }));
+  _TEST_ASSERT(0, ({ int i=0; switch(7) { case 1:i=11;break; case 2:i=12;break; case 3:i=13;break; case 5:i=15;break; case 6:i=16;break; } i; }));
+  _TEST_ASSERT(9, ({ int i=0; switch(0) { case 1:i=11;break; case 2:i=12;break; case 3:i=13;break; case 5:i=15;break; default:i=9; } i; }));
+  _TEST_ASSERT(12, ({ int i=0; switch(-1) { case -3:i=10;break; case -2:i=11;break; case -1:i=12;break; case 0:i=13;break; } i; }));
+  _TEST_ASSERT(5, ({ int i=0; switch(500) { case 1:i=1;break; case 10:i=2;break; case 100:i=3;break; case 200:i=4;break; case 500:i=5;break; case 1000:i=6;break; case 5000:i=7;break; } i; }));
+  _TEST_ASSERT(1, ({ int i=0; switch(1) { case 1:i=1;break; case 10:i=2;break; case 100:i=3;break; case 200:i=4;break; case 500:i=5;break; case 1000:i=6;break; case 5000:i=7;break; } i; }));
+  _TEST_ASSERT(7, ({ int i=0; switch(5000) { case 1:i=1;break; case 10:i=2;break; case 100:i=3;break; case 200:i=4;break; case 500:i=5;break; case 1000:i=6;break; case 5000:i=7;break; } i; }));
+  _TEST_ASSERT(9, ({ int i=0; switch(300) { case 1:i=1;break; case 10:i=2;break; case 100:i=3;break; case 200:i=4;break; case 500:i=5;break; case 1000:i=6;break; default:i=9; } i; }));
+  _TEST_ASSERT(2, ({ int i=0; switch(-100) { case -1000:i=1;break; case -100:i=2;break; case 0:i=3;break; case 100:i=4;break; case 1000:i=5;break; } i; }));
+  _TEST_ASSERT(3, ({ int i=0; unsigned x=0xfffffff0; switch(x) { case 1:i=1;break; case 100:i=2;break; case 0xfffffff0:i=3;break; case 0x80000000:i=4;break; case 1000:i=5;break; } i; }));
+  _TEST_ASSERT(4, ({ int i=0; unsigned x=0x80000000; switch(x) { case 1:i=1;break; case 100:i=2;break; case 0xfffffff0:i=3;break; case 0x80000000:i=4;break; case 1000:i=5;break; } i; }));
 
   _TEST_ASSERT(7, ({ int i=0; int j=0; do { j++; } while (i++ < 6); j; }));
   _TEST_ASSERT(4, ({ int i=0; int j=0; int k=0; do { if (++j > 3) break; continue; k++; } while (1); j; }));
 
+  _TEST_ASSERT(5, ({ int i=0; goto a2; if (0) { a2: i=5; } i; }));
+  _TEST_ASSERT(3, ({ int i=0; switch(1) { if (0) { case 1: i=3; } } i; }));
+  _TEST_ASSERT(2, ({ int i=0; while (0) i=1; for (;1;) { i=2; break; } i; }));
+  _TEST_ASSERT(4, ({ int i=3; 0 ? i : i+1; }));
+  _TEST_ASSERT(10, ({ int i=0; int t=0; a: t+=i; if (++i < 5) goto a; t; }));
+  _TEST_ASSERT(12, ({ int t=0; int k; for (k=0; k<4; k++) { switch (k) { case 0: t+=1; break; case 1: t+=2; case 2: t+=3; break; default: t+=k; } } t; }));
+  _TEST_ASSERT(21, ({ int a=1; int b=2; int c=3; int d=4; int e=5; int f=6; a+b+c+d+e+f; }));
+  _TEST_ASSERT(3, ({ int a=7; int b=2; int c=a/b; int d=a%b; c*d; }));
+
   return 0;
 }
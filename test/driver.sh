@@ -18,6 +18,77 @@ rm -f $tmp/out
 [ -f $tmp/out ]
 check -o
 
+# stdin
+rm -f $tmp/out
+echo 'int main() { return 0; }' | ./chibicc -o $tmp/out -
+grep -q FUNCTION_main $tmp/out
+check stdin
+
+# file without a trailing newline
+printf 'int main() { return 0; }' > $tmp/nonl.c
+rm -f $tmp/out
+./chibicc -o $tmp/out $tmp/nonl.c
+grep -q FUNCTION_main $tmp/out
+check 'missing newline'
+
+# integer literal wider than 32 bits
+echo 'int main() { return 99999999999; }' > $tmp/wide.c
+./chibicc -o $tmp/out $tmp/wide.c 2>&1 | grep -q 'warning: integer literal is too large'
+check 'wide literal warning'
+grep -q FUNCTION_main $tmp/out
+check 'wide literal compiles'
+
+# duplicate case values
+echo 'int main() { switch (0) { case 1: case 2: case 2: case 3: case 4: ; } return 0; }' | ./chibicc -o $tmp/out - 2>&1 | grep -q 'duplicate case value'
+check 'duplicate case'
+
+# run-time relocation outside of the file defining main
+printf 'extern int arr[];\nint *p = arr + 1;\nint f(void) { return *p; }\n' > $tmp/reloc.c
+./chibicc -o $tmp/out $tmp/reloc.c 2>&1 | grep -q 'file defining main'
+check 'relocation without main'
+
+# -fno-fold: constant factors are combined
+echo 'int f(int x) { return x*4*2; }' > $tmp/mul.c
+./chibicc -fno-fold -o $tmp/out $tmp/mul.c
+[ `grep -c '^imul' $tmp/out` -eq 2 ]
+check '-fno-fold multiply'
+./chibicc -o $tmp/out $tmp/mul.c
+[ `grep -c '^imul' $tmp/out` -eq 1 ] && grep -q '^imul_ebx, %8$' $tmp/out
+check 'fold multiply'
+
+# -fno-fold: an arm that is never taken is pruned
+echo 'int f(int a) { if (0) a = 12345; return a; }' > $tmp/if0.c
+./chibicc -fno-fold -o $tmp/out $tmp/if0.c
+grep -q '%12345' $tmp/out
+check '-fno-fold if (0)'
+./chibicc -o $tmp/out $tmp/if0.c
+! grep -q '%12345' $tmp/out
+check 'fold if (0)'
+
+# -fno-ir
+rm -f $tmp/out
+echo 'int main() { return 0; }' | ./chibicc -fno-ir -o $tmp/out -
+grep -q FUNCTION_main $tmp/out
+check -fno-ir
+
+# -fno-peephole: a reload of the value just stored
+echo 'int main() { int x = 3; return x; }' > $tmp/reload.c
+./chibicc -fno-peephole -o $tmp/out $tmp/reload.c
+grep -q 'mov_ebx,\[ebp+DWORD\] %-4' $tmp/out
+check '-fno-peephole reload'
+./chibicc -o $tmp/out $tmp/reload.c
+! grep -q 'mov_ebx,\[ebp+DWORD\] %-4' $tmp/out
+check 'peephole reload'
+
+# -fno-peephole: a jump to the next line
+echo 'int f(int a) { if (a) return 1; return 2; }' > $tmp/jump.c
+./chibicc -fno-ir -fno-peephole -o $tmp/out $tmp/jump.c
+grep -A1 '^jmp %BUILTIN_return_f' $tmp/out | grep -q '^:BUILTIN_return_f'
+check '-fno-peephole jump'
+./chibicc -fno-ir -o $tmp/out $tmp/jump.c
+! grep -A1 '^jmp %BUILTIN_return_f' $tmp/out | grep -q '^:BUILTIN_return_f'
+check 'peephole jump'
+
 # --help
 ./chibicc --help 2>&1 | grep -q chibicc
 check --help
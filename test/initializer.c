@@ -34,6 +34,16 @@ typedef struct { char a, b[]; } T65;
 T65 g65 = {'f','o','o',0};
 T65 g66 = {'f','o','o','b','a','r',0};
 
+int g70(void) { return 70; }
+int (*g71)(void) = g70;
+int *g72 = g26 + 3;
+int g73[1000] = {1, 2, 3};
+char g74[300] = "xyz";
+int g75[3][100] = {{1}, {2, 3}};
+char *g76[2] = {"ab", "cd"};
+char *g77 = (char *)g76 + 2;
+char *g78 = (char *)g76 + 4;
+
 int main() {
   _TEST_ASSERT(1, ({ int x[3]={1,2,3}; x[0]; }));
   _TEST_ASSERT(2, ({ int x[3]={1,2,3}; x[1]; }));
@@ -51,6 +61,8 @@ int main() {
   _TEST_ASSERT(2, ({ int x[2][3]={{1,2}}; x[0][1]; }));
   _TEST_ASSERT(0, ({ int x[2][3]={{1,2}}; x[1][0]; }));
   _TEST_ASSERT(0, ({ int x[2][3]={{1,2}}; x[1][2]; }));
+  _TEST_ASSERT(1, ({ int j=0; int s=0; for (;j<2;j++) { char x[7]={1}; s+=x[0]+x[4]+x[5]+x[6]; x[4]=x[5]=x[6]=9; } s-1; }));
+  _TEST_ASSERT(1, ({ int j=0; int s=0; for (;j<2;j++) { char x[101]={1}; s+=x[0]+x[3]+x[99]+x[100]; x[3]=x[99]=x[100]=9; } s-1; }));
 
   _TEST_ASSERT('a', ({ char x[4]="abc"; x[0]; }));
   _TEST_ASSERT('c', ({ char x[4]="abc"; x[2]; }));
@@ -88,6 +100,9 @@ int main() {
 
   _TEST_ASSERT(5, ({ typedef struct {int a,b,c,d,e,f;} T; T x={1,2,3,4,5,6}; T y; y=x; y.e; }));
   _TEST_ASSERT(2, ({ typedef struct {int a,b;} T; T x={1,2}; T y, z; z=y=x; z.b; }));
+  _TEST_ASSERT(6, ({ typedef struct {char a,b,c;} T; T x={1,2,3}; T y; y=x; y.a+y.b+y.c; }));
+  _TEST_ASSERT(10, ({ typedef struct {char a[37]; char b;} T; T x; x.a[36]=7; x.b=3; T y; y=x; y.a[36]+y.b; }));
+  _TEST_ASSERT(4, ({ typedef struct {int a[20];} T; T x; x.a[19]=4; T y, z; z=y=x; z.a[19]; }));
 
   _TEST_ASSERT(1, ({ typedef struct {int a,b;} T; T x={1,2}; T y=x; y.a; }));
 
@@ -180,6 +195,23 @@ int main() {
   _TEST_ASSERT('f', g44[0]);
   _TEST_ASSERT('o', g44[2]);
 
+  _TEST_ASSERT(1, g71 == &g70);
+  _TEST_ASSERT(3, g72 - g26);
+
+  _TEST_ASSERT(3, g73[2]);
+  _TEST_ASSERT(0, g73[999]);
+  _TEST_ASSERT('z', g74[2]);
+  _TEST_ASSERT(0, g74[299]);
+  _TEST_ASSERT(3, g75[1][1]);
+  _TEST_ASSERT(0, g75[2][50]);
+  _TEST_ASSERT(2, g77 - (char *)g76);
+  _TEST_ASSERT('c', (*(char **)g78)[0]);
+
+  _TEST_ASSERT(3, ({ int t[10000]={1,2,3}; t[2]+t[9999]; }));
+  _TEST_ASSERT('b', ({ char s[1000]="ab"; s[1]+s[999]; }));
+  _TEST_ASSERT(3, ({ struct {int a; int b[50];} x={1, {0, 2}}; x.a+x.b[0]+x.b[1]+x.b[49]; }));
+  _TEST_ASSERT(0, ({ int x=1; { int y[4]={0}; x=y[0]+y[3]; } x; }));
+
   _TEST_ASSERT(3, ({ int a[]={1,2,3,}; a[2]; }));
   _TEST_ASSERT(1, ({ struct {int a,b,c;} x={1,2,3,}; x.a; }));
   _TEST_ASSERT(1, ({ union {int a; char b;} x={1,}; x.a; }));
@@ -60,6 +60,11 @@ int main() {
   _TEST_ASSERT(4, sizeof(0b1111111111111111111111111111111111));
   _TEST_ASSERT(1, 0b11111111111111111111111111111111111>>31);
 
+  _TEST_ASSERT(0, 0x100000000 < 0);
+  _TEST_ASSERT(1, 0x100000001 > 0);
+  _TEST_ASSERT(1, 0x100000000 >> 31 == 0);
+  _TEST_ASSERT(7, 0xfEdCbA987 & 0xf);
+
   _TEST_ASSERT(-1, 1 << 31 >> 31);
   _TEST_ASSERT(-1, 01 << 31 >> 31);
   _TEST_ASSERT(-1, 0x1 << 31 >> 31);
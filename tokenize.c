@@ -4,6 +4,13 @@
 char *current_input;
 char *current_filename;
 
+// line_starts[i] points to the first character of line i + 1. The table is
+// filled in by tokenize() as it passes each newline, so it is sorted and
+// any location can be mapped to its line by binary search.
+char **line_starts;
+int line_count;
+int line_capacity;
+
 // Reports an error and exit.
 void error(char *fmt) {
 	fputs(fmt, stderr);
@@ -11,11 +18,12 @@ void error(char *fmt) {
 	exit(1);
 }
 
-// Reports an error message in the following format and exits.
+// Prints the line of a location with a caret under it, in the format
+// below, leaving the message to the caller.
 //
 // foo.c:10: x = y + 1;
-//               ^ error message
-void error_line_at(int line_no, char *loc, char *fmt) {
+//               ^ message
+void show_line_at(int line_no, char *loc) {
 	char *end = loc;
 	while (*end != '\n') {
 		end += 1;
@@ -47,26 +55,24 @@ void error_line_at(int line_no, char *loc, char *fmt) {
 		fputc(' ', stderr);
 	}
 	fputs("^ ", stderr);
+}
+
+// Reports an error message under the line it is on and exits.
+void error_line_at(int line_no, char *loc, char *fmt) {
+	show_line_at(line_no, loc);
 	error(fmt);
 }
 
 void error_at(char *loc, char *fmt) {
-	// Find a line contianing `loc`.
-	char *line = loc;
-	while (current_input < line && line[-1] != '\n') {
-		line -= 1;
-	}
-
-	// Get a line number.
-	int line_no = 1;
-	char *p;
-	for (p = current_input; p < line; p += 1) {
-		if (*p == '\n') {
-			line_no += 1;
-		}
-	}
+	error_line_at(loc_line(loc), loc, fmt);
+}
 
-	error_line_at(line_no, loc, fmt);
+// Reports a warning in the same format, and carries on.
+void warn_at(char *loc, char *fmt) {
+	show_line_at(loc_line(loc), loc);
+	fputs("warning: ", stderr);
+	fputs(fmt, stderr);
+	fputc('\n', stderr);
 }
 
 void error_tok(Token *tok, char *fmt) {
@@ -107,12 +113,53 @@ int consume(Token **rest, Token *tok, char *str) {
 	return FALSE;
 }
 
-// Create a new token.
+// Records that a new line starts at p.
+void add_line(char *p) {
+	char **old;
+	if (line_count == line_capacity) {
+		old = line_starts;
+		line_capacity = line_capacity * 2;
+		line_starts = calloc(line_capacity, sizeof(char*));
+		memcpy(line_starts, old, line_count * sizeof(char*));
+		free(old);
+	}
+	line_starts[line_count] = p;
+	line_count += 1;
+}
+
+// Returns the index into line_starts of the line containing loc.
+int find_line(char *loc) {
+	int lo = 0;
+	int hi = line_count - 1;
+	int mid;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (line_starts[mid] <= loc) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+
+// Returns the line number of loc, counting from 1.
+int loc_line(char *loc) {
+	return find_line(loc) + 1;
+}
+
+// Returns the column number of loc, counting from 1.
+int loc_column(char *loc) {
+	return loc - line_starts[find_line(loc)] + 1;
+}
+
+// Create a new token on the current line.
 Token *new_token(int kind, char *start, char *end) {
-	Token *tok = calloc(1, sizeof(Token));
+	Token *tok = arena_alloc(token_arena, sizeof(Token));
 	tok->kind = kind;
 	tok->loc = start;
 	tok->len = end - start;
+	tok->line_no = line_count;
 	return tok;
 }
 
@@ -136,81 +183,205 @@ int from_hex(char c) {
 	return c - 'A' + 10;
 }
 
-// Read a punctuator toekn from p and return its length.
-int read_punct(char *p) {
-	if (startswith(p, "<<=") ||
-			startswith(p, ">>=")) {
-		return 3;
-	}
-	if (startswith(p, "==") ||
-			startswith(p, "!=") ||
-			startswith(p, "<=") ||
-			startswith(p, ">=") ||
-			startswith(p, "->") ||
-			startswith(p, "+=") || 
-			startswith(p, "-=") ||
-			startswith(p, "*=") ||
-			startswith(p, "/=") ||
-			startswith(p, "++") ||
-			startswith(p, "--") ||
-			startswith(p, "%=") ||
-			startswith(p, "&=") ||
-			startswith(p, "|=") ||
-			startswith(p, "^=") ||
-			startswith(p, "&&") ||
-			startswith(p, "||") ||
-			startswith(p, "<<") ||
-			startswith(p, ">>")) {
-		return 2;
-	}
-
-	if (isapunct(*p)) {
-		return 1;
-	} else {
-		return 0;
-	}
-}
-
-int is_keyword(Token *tok) {
-	if (equal(tok, "return") ||
-			equal(tok, "if") ||
-			equal(tok, "else") ||
-			equal(tok, "for") ||
-			equal(tok, "while") ||
-			equal(tok, "int") ||
-			equal(tok, "sizeof") ||
-			equal(tok, "char") ||
-			equal(tok, "_TEST_ASSERT") ||
-			equal(tok, "struct") ||
-			equal(tok, "long") ||
-			equal(tok, "short") ||
-			equal(tok, "void") ||
-			equal(tok, "typedef") ||
-			equal(tok, "_Bool") ||
-			equal(tok, "enum") ||
-			equal(tok, "static") ||
-			equal(tok, "goto") ||
-			equal(tok, "break") ||
-			equal(tok, "continue") ||
-			equal(tok, "switch") ||
-			equal(tok, "case") ||
-			equal(tok, "default") ||
-			equal(tok, "extern") ||
-			equal(tok, "_Alignof") ||
-			equal(tok, "do") ||
-			equal(tok, "signed") ||
-			equal(tok, "unsigned") ||
-			equal(tok, "const") ||
-			equal(tok, "volatile") ||
-			equal(tok, "auto") ||
-			equal(tok, "register") ||
-			equal(tok, "restrict") ||
-			equal(tok, "__restrict") ||
-			equal(tok, "__restrict__") ||
-			equal(tok, "_Noreturn")) {
-		return TRUE;
+// Punctuators are recognised by a DFA whose states are punctuator codes.
+// punct_dfa[state * 128 + c] is the code of the punctuator formed by
+// appending c to the punctuator `state`, or PU_NONE. State PU_NONE is the
+// start state. Every prefix of a punctuator is itself a punctuator, so the
+// longest match is found with one table lookup per character.
+int *punct_dfa;
+
+void add_punct(int code, char *str) {
+	int state = PU_NONE;
+	while (str[1] != '\0') {
+		state = punct_dfa[state * 128 + str[0]];
+		str += 1;
 	}
-	return FALSE;
+	punct_dfa[state * 128 + str[0]] = code;
+}
+
+void initialize_puncts(void) {
+	punct_dfa = calloc(PU_COUNT * 128, sizeof(int));
+
+	int c;
+	for (c = 1; c < 128; c += 1) {
+		if (isapunct(c)) {
+			punct_dfa[c] = c;
+		}
+	}
+
+	add_punct(PU_EQ, "==");
+	add_punct(PU_NE, "!=");
+	add_punct(PU_LE, "<=");
+	add_punct(PU_GE, ">=");
+	add_punct(PU_ARROW, "->");
+	add_punct(PU_ADD_ASSIGN, "+=");
+	add_punct(PU_SUB_ASSIGN, "-=");
+	add_punct(PU_MUL_ASSIGN, "*=");
+	add_punct(PU_DIV_ASSIGN, "/=");
+	add_punct(PU_MOD_ASSIGN, "%=");
+	add_punct(PU_AND_ASSIGN, "&=");
+	add_punct(PU_OR_ASSIGN, "|=");
+	add_punct(PU_XOR_ASSIGN, "^=");
+	add_punct(PU_INC, "++");
+	add_punct(PU_DEC, "--");
+	add_punct(PU_LOGAND, "&&");
+	add_punct(PU_LOGOR, "||");
+	add_punct(PU_SHL, "<<");
+	add_punct(PU_SHR, ">>");
+	add_punct(PU_SHL_ASSIGN, "<<=");
+	add_punct(PU_SHR_ASSIGN, ">>=");
+}
+
+// Read a punctuator token from p, or return NULL if there is none.
+Token *read_punct(char *p) {
+	int state = PU_NONE;
+	int next;
+	char *q = p;
+	while (TRUE) {
+		if (*q <= 0 || *q >= 128) {
+			break;
+		}
+		next = punct_dfa[state * 128 + *q];
+		if (next == PU_NONE) {
+			break;
+		}
+		state = next;
+		q += 1;
+	}
+
+	if (state == PU_NONE) {
+		return NULL;
+	}
+
+	Token *tok = new_token(TK_PUNCT, p, q);
+	tok->punct = state;
+	return tok;
+}
+
+// Keywords are recognised with a perfect hash over the length and the first
+// and last characters of an identifier. keyword_table maps a hash to a
+// keyword ID, and keyword_names maps a keyword ID back to its spelling.
+// The hash is collision-free for the keywords below; add_keyword() checks
+// that this still holds when a keyword is added.
+#define KEYWORD_TABLE_SIZE 128
+
+int *keyword_table;
+char **keyword_names;
+
+int keyword_hash(char *p, int len) {
+	return (len + p[0] * 9 + p[len - 1] * 31) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+void add_keyword(int id, char *name) {
+	int h = keyword_hash(name, strlen(name));
+	if (keyword_table[h] != KW_NONE) {
+		error("internal error: keyword hash collision");
+	}
+	keyword_table[h] = id;
+	keyword_names[id] = name;
+}
+
+void initialize_keywords(void) {
+	keyword_table = calloc(KEYWORD_TABLE_SIZE, sizeof(int));
+	keyword_names = calloc(KW_COUNT, sizeof(char*));
+
+	add_keyword(KW_BOOL, "_Bool");
+	add_keyword(KW_CHAR, "char");
+	add_keyword(KW_SHORT, "short");
+	add_keyword(KW_INT, "int");
+	add_keyword(KW_LONG, "long");
+	add_keyword(KW_STRUCT, "struct");
+	add_keyword(KW_UNION, "union");
+	add_keyword(KW_VOID, "void");
+	add_keyword(KW_TYPEDEF, "typedef");
+	add_keyword(KW_ENUM, "enum");
+	add_keyword(KW_STATIC, "static");
+	add_keyword(KW_EXTERN, "extern");
+	add_keyword(KW_SIGNED, "signed");
+	add_keyword(KW_UNSIGNED, "unsigned");
+	add_keyword(KW_CONST, "const");
+	add_keyword(KW_VOLATILE, "volatile");
+	add_keyword(KW_AUTO, "auto");
+	add_keyword(KW_REGISTER, "register");
+	add_keyword(KW_RESTRICT, "restrict");
+	add_keyword(KW___RESTRICT, "__restrict");
+	add_keyword(KW___RESTRICT__, "__restrict__");
+	add_keyword(KW_NORETURN, "_Noreturn");
+	add_keyword(KW_RETURN, "return");
+	add_keyword(KW_IF, "if");
+	add_keyword(KW_ELSE, "else");
+	add_keyword(KW_FOR, "for");
+	add_keyword(KW_WHILE, "while");
+	add_keyword(KW_SIZEOF, "sizeof");
+	add_keyword(KW_TEST_ASSERT, "_TEST_ASSERT");
+	add_keyword(KW_GOTO, "goto");
+	add_keyword(KW_BREAK, "break");
+	add_keyword(KW_CONTINUE, "continue");
+	add_keyword(KW_SWITCH, "switch");
+	add_keyword(KW_CASE, "case");
+	add_keyword(KW_DEFAULT, "default");
+	add_keyword(KW_ALIGNOF, "_Alignof");
+	add_keyword(KW_DO, "do");
+}
+
+// Returns the keyword ID of the identifier [p, p+len), or KW_NONE.
+int keyword_id(char *p, int len) {
+	int id = keyword_table[keyword_hash(p, len)];
+	if (id == KW_NONE) {
+		return KW_NONE;
+	}
+
+	char *name = keyword_names[id];
+	if (strncmp(name, p, len) == 0 && name[len] == '\0') {
+		return id;
+	}
+	return KW_NONE;
+}
+
+// Identifiers are interned so that each distinct spelling has exactly one
+// NUL-terminated copy, its atom. Tokens, scopes and objects all share these
+// atoms, so two names are the same if and only if their pointers are equal.
+#define IDENT_TABLE_SIZE 16384
+
+struct Ident {
+	struct Ident *next;
+	char *name;
+	int len;
+};
+typedef struct Ident Ident;
+
+Ident **ident_table;
+
+int ident_hash(char *p, int len) {
+	uint32_t h = 2166136261;
+	int i;
+	for (i = 0; i < len; i += 1) {
+		h = (h ^ p[i]) * 16777619;
+	}
+	return h & (IDENT_TABLE_SIZE - 1);
+}
+
+void initialize_idents(void) {
+	ident_table = calloc(IDENT_TABLE_SIZE, sizeof(Ident*));
+}
+
+// Returns the atom for the identifier [p, p+len), creating it if needed.
+char *intern(char *p, int len) {
+	int h = ident_hash(p, len);
+	Ident *id;
+	for (id = ident_table[h]; id != NULL; id = id->next) {
+		if (id->len == len && memcmp(id->name, p, len) == 0) {
+			return id->name;
+		}
+	}
+
+	id = arena_alloc(token_arena, sizeof(Ident));
+	id->name = arena_alloc(token_arena, len + 1);
+	memcpy(id->name, p, len);
+	id->len = len;
+	id->next = ident_table[h];
+	ident_table[h] = id;
+	return id->name;
 }
 
 int read_escaped_char(char **new_pos, char *p) {
@@ -268,23 +439,29 @@ int read_escaped_char(char **new_pos, char *p) {
 	}
 }
 
-// Find a closing double-quote.
+// Find a closing double-quote. strpbrk() jumps over runs of plain
+// characters, stopping only at quotes, escapes and newlines.
 char *string_literal_end(char *p) {
 	char *start = p;
-	for (p; *p != '"'; p += 1) {
-		if (*p == '\n' || *p == '\0') {
+	while (TRUE) {
+		p = strpbrk(p, "\"\\\n");
+		if (p == NULL || *p == '\n') {
 			error_at(start, "unclosed string literal");
 		}
-		if (*p == '\\') {
-			p += 1;
+		if (*p == '"') {
+			return p;
 		}
+		// Skip the escaped character.
+		if (p[1] == '\0') {
+			error_at(start, "unclosed string literal");
+		}
+		p += 2;
 	}
-	return p;
 }
 
 Token *read_string_literal(char *start) {
 	char *end = string_literal_end(start + 1);
-	char *buf = calloc(1, end - start);
+	char *buf = arena_alloc(token_arena, end - start);
 	int len = 0;
 
 	char *p;
@@ -330,42 +507,47 @@ Token *read_char_literal(char *start) {
 	return tok;
 }
 
+// Read an integer literal. The prefix, digits and suffixes are classified
+// in place, without copying the rest of the input.
 Token *read_int_literal(char *start) {
 	int base = 10;
 	char *p = start;
-	char *set = "0123456789";
-	if (!strncmp(stolower(string_slice(p, p+2)), "0x", 2) && isaxdigit(p[2])) {
+	if (p[0] == '0' && ctolower(p[1]) == 'x' && isaxdigit(p[2])) {
 		p += 2;
 		base = 16;
-		set = "0123456789abcdef";
-	} else if (!strncmp(stolower(string_slice(p, p+2)), "0b", 2) && (p[2] == '0' || p[2] == '1')) {
+	} else if (p[0] == '0' && ctolower(p[1]) == 'b' && (p[2] == '0' || p[2] == '1')) {
 		p += 2;
 		base = 2;
-		set = "01";
 	} else if (*p == '0') {
 		base = 8;
-		set = "01234567";
 	}
 
-	int32_t val = 0;
+	// Literals wider than 32 bits wrap around with a warning, and we
+	// remember that they did so that type inference below can take it into
+	// account.
+	uint32_t val = 0;
+	int overflow = FALSE;
 	int digit;
-	char *pos;
-	for (p; isadigit(*p) || isaxdigit(*p); p += 1) {
-		pos = strchr(set, ctolower(*p));
-		if (pos == NULL) {
+	for (p; isaxdigit(*p); p += 1) {
+		digit = from_hex(*p);
+		if (digit >= base) {
 			error_at(p, "invalid digit");
 		}
-		val *= base;
-		digit = pos - set;
-		val += digit;
+		if (val > (0xffffffff - digit) / base) {
+			overflow = TRUE;
+		}
+		val = val * base + digit;
+	}
+	if (overflow) {
+		warn_at(start, "integer literal is too large for 32 bits and wraps around");
 	}
 
 	// Read U or L suffixes.
 	int l = FALSE;
 	int u = FALSE;
 
-	if (!strncmp(stolower(string_slice(p, p+2)), "lu", 2) ||
-			!strncmp(stolower(string_slice(p, p+2)), "ul", 2)) {
+	if ((ctolower(p[0]) == 'l' && ctolower(p[1]) == 'u') ||
+			(ctolower(p[0]) == 'u' && ctolower(p[1]) == 'l')) {
 		p += 2;
 		l = TRUE;
 		u = TRUE;
@@ -393,12 +575,12 @@ Token *read_int_literal(char *start) {
 		if (l && u) {
 			ty = ty_ulong;
 		} else if (l) {
-			if (val >> 31) {
+			if (overflow || val >> 31) {
 				ty = ty_ulong;
 			} else {
 				ty = ty_long;
 			}
-		} else if (val >> 31) {
+		} else if (overflow || val >> 31) {
 			ty = ty_uint;
 		} else {
 			ty = ty_int;
@@ -411,70 +593,64 @@ Token *read_int_literal(char *start) {
 	return tok;
 }
 
-void convert_keywords(Token *tok) {
-	Token *t;
-	for (t = tok; t->kind != TK_EOF; t = t->next) {
-		if (is_keyword(t)) {
-			t->kind = TK_KEYWORD;
+// Skip a run of whitespace, recording the start of each line passed.
+char *skip_whitespace(char *p) {
+	while (isspace(*p)) {
+		if (*p == '\n') {
+			add_line(p + 1);
 		}
+		p += 1;
 	}
+	return p;
 }
 
-// Initialize line number info for all tokens.
-void add_line_numbers(Token *tok) {
-	char *p = current_input;
-	int n = 1;
-
-	while (*p) {
-		if (p == tok->loc) {
-			tok->line_no = n;
-			tok = tok->next;
+// Skip the block comment starting at p, recording the start of each line
+// in its body, and return the position just past it.
+char *skip_block_comment(char *p) {
+	char *q = p + 2;
+	while (q[0] != '*' || q[1] != '/') {
+		if (*q == '\n') {
+			add_line(q + 1);
+		} else if (*q == '\0') {
+			error_at(p, "unclosed block comment");
 		}
-		if (*p == '\n') {
-			n += 1;
-		}
-		p += 1;
+		q += 1;
 	}
+	return q + 2;
 }
 
 // Tokenize a given string and return new tokens.
 Token *tokenize(char *filename, char *p) {
 	current_filename = filename;
 	current_input = p;
-	Token *head = calloc(1, sizeof(Token));
+
+	line_capacity = 1024;
+	line_starts = calloc(line_capacity, sizeof(char*));
+	line_count = 0;
+	add_line(p);
+
+	Token *head = arena_alloc(token_arena, sizeof(Token));
 	Token *cur = head;
 
 	char *start;
-	char *end;
-	char *q;
-	int punct_len;
+	Token *tok;
 	while (*p) {
-		// Skip line comments.
-		if (startswith(p, "//")) {
-			p += 2;
-			while (*p != '\n') {
-				p += 1;
-			}
+		// Skip whitespace characters.
+		if (isspace(*p)) {
+			p = skip_whitespace(p);
 			continue;
 		}
 
-		// Skip block comments.
-		if (startswith(p, "/*")) {
-			q = p;
-			// M2-Planet bug where cannot have both *q and startswith in condition.
-			while (!startswith(q, "*/")) {
-				q += 1;
-				if (!*q) {
-					error_at(p, "unclosed block comment");
-				}
-			}
-			p = q + 2;
+		// Skip line comments. The input always ends with a newline, so
+		// there is one to find.
+		if (p[0] == '/' && p[1] == '/') {
+			p = strchr(p + 2, '\n');
 			continue;
 		}
 
-		// Skip whitespace characters.
-		if (isspace(*p)) {
-			p += 1;
+		// Skip block comments.
+		if (p[0] == '/' && p[1] == '*') {
+			p = skip_block_comment(p);
 			continue;
 		}
 
@@ -510,13 +686,19 @@ Token *tokenize(char *filename, char *p) {
 			} while (is_ident2(*p));
 			cur->next = new_token(TK_IDENT, start, p);
 			cur = cur->next;
+			cur->keyword = keyword_id(start, p - start);
+			if (cur->keyword != KW_NONE) {
+				cur->kind = TK_KEYWORD;
+			} else {
+				cur->ident = intern(start, p - start);
+			}
 			continue;
 		}
 
 		// Punctuators
-		punct_len = read_punct(p);
-		if (punct_len) {
-			cur->next = new_token(TK_PUNCT, p, p + punct_len);
+		tok = read_punct(p);
+		if (tok != NULL) {
+			cur->next = tok;
 			cur = cur->next;
 			p += cur->len;
 			continue;
@@ -527,12 +709,15 @@ Token *tokenize(char *filename, char *p) {
 
 	cur->next = new_token(TK_EOF, p, p);
 	cur = cur->next;
-	add_line_numbers(head->next);
-	convert_keywords(head->next);
 	return head->next;
 }
 
 // Returns the contents of a given file.
+//
+// The buffer is laid out as "\n" contents "\n" "\0" and a pointer just past
+// the leading newline is returned, so that show_line_at() can scan both
+// backwards and forwards for a newline without running off either end, and
+// tokenize() can stop at the terminating NUL.
 char *read_file(char *path) {
 	FILE *fp;
 
@@ -549,27 +734,51 @@ char *read_file(char *path) {
 		}
 	}
 
+	// Size the buffer once for regular files. Pipes and stdin cannot be
+	// seeked, so we start with a guess and grow it geometrically below.
 	int length = MAX_STRING;
-	char *buf = calloc(length, sizeof(char));
+	if (fp != stdin) {
+		fseek(fp, 0, SEEK_END);
+		length = ftell(fp) + 1;
+		if (length < MAX_STRING) {
+			length = MAX_STRING;
+		}
+		fseek(fp, 0, SEEK_SET);
+	}
+
+	// Reserve room for the leading newline and the trailing newline and NUL.
+	char *buf = calloc(length + 3, sizeof(char));
 	char *oldbuf;
 	int count = 0;
-	char c = fgetc(fp);
-	while (c != EOF) {
-		buf[count] = c;
-		c = fgetc(fp);
-		count += 1;
+	int n;
+	buf[0] = '\n';
+	while (TRUE) {
+		n = fread(buf + 1 + count, sizeof(char), length - count, fp);
+		if (n <= 0) {
+			break;
+		}
+		count += n;
+
 		if (count == length) {
 			oldbuf = buf;
-			length += MAX_STRING;
-			buf = calloc(length, sizeof(char));
-			strcpy(buf, oldbuf);
+			length = length * 2;
+			buf = calloc(length + 3, sizeof(char));
+			memcpy(buf, oldbuf, count + 1);
+			free(oldbuf);
 		}
 	}
 
 	if (fp != stdin) {
 		fclose(fp);
 	}
-	return buf;
+
+	// Make sure that the last line is properly terminated with '\n'.
+	if (count == 0 || buf[count] != '\n') {
+		buf[count + 1] = '\n';
+		count += 1;
+	}
+	buf[count + 1] = '\0';
+	return buf + 1;
 }
 
 Token *tokenize_file(char *path) {
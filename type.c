@@ -13,7 +13,7 @@ Type *ty_uint;
 Type *ty_ulong;
 
 Type *new_type(int kind, int size, int align) {
-	Type *ty = calloc(1, sizeof(Type));
+	Type *ty = arena_alloc(ast_arena, sizeof(Type));
 	ty->kind = kind;
 	ty->size = size;
 	ty->align = align;
@@ -48,30 +48,49 @@ int is_integer(Type *ty) {
 		k == TY_ENUM;
 }
 
+// Returns a copy of t. The copy is a distinct type, so it does not share
+// the derived types interned on t.
 Type *copy_type(Type *t) {
-	Type *ret = calloc(1, sizeof(Type));
+	Type *ret = arena_alloc(ast_arena, sizeof(Type));
 	memcpy(ret, t, sizeof(Type));
+	ret->pointer_cache = NULL;
+	ret->array_cache = NULL;
+	ret->array_next = NULL;
 	return ret;
 }
 
 Type *pointer_to(Type *base) {
+	if (base->pointer_cache != NULL) {
+		return base->pointer_cache;
+	}
+
 	Type *ty = new_type(TY_PTR, 4, 4);
 	ty->base = base;
 	ty->is_unsigned = TRUE;
+	base->pointer_cache = ty;
 	return ty;
 }
 
 Type *func_type(Type *return_ty) {
-	Type *ty = calloc(1, sizeof(Type));
+	Type *ty = arena_alloc(ast_arena, sizeof(Type));
 	ty->kind = TY_FUNC;
 	ty->return_ty = return_ty;
 	return ty;
 }
 
 Type *array_of(Type *base, int len) {
-	Type *ty = new_type(TY_ARRAY, base->size * len, base->align);
+	Type *ty;
+	for (ty = base->array_cache; ty != NULL; ty = ty->array_next) {
+		if (ty->array_len == len) {
+			return ty;
+		}
+	}
+
+	ty = new_type(TY_ARRAY, base->size * len, base->align);
 	ty->base = base;
 	ty->array_len = len;
+	ty->array_next = base->array_cache;
+	base->array_cache = ty;
 	return ty;
 }
 
@@ -39,33 +39,75 @@ char ctolower(char c) {
 	}
 }
 
-char *stolower(char *s) {
-	char *out = calloc(strlen(s) + 1, sizeof(char));
-	char *result = out;
-	strcpy(out, s);
-	while (s[0] != '\0') {
-		out[0] = ctolower(*s);
-		out += 1;
-		s += 1;
-	}
-	out[0] = '\0';
-	return result;
-}
-
 // startswith
 int startswith(char *p, char *q) {
 	return strncmp(p, q, strlen(q)) == 0;
 }
 
-// Get slice
-char *string_slice(char *original, char *end) {
-	int diff = end - original;
-	char *slice = calloc(strlen(original) + 1, sizeof(char));
-	strcpy(slice, original);
-	slice[diff] = '\0';
-	return slice;
-}
-
 char *uint2str(int i) {
 	return int2str(i, 10, FALSE);
 }
+
+// Arenas are bump-pointer allocators. Memory is carved out of large zeroed
+// chunks, so an allocation is a pointer increment and objects allocated
+// together sit next to each other. Nothing is freed individually; an arena
+// can only be reset as a whole, which zeroes it for reuse.
+#define ARENA_CHUNK_SIZE 65536
+
+Arena *token_arena;
+Arena *ast_arena;
+Arena *scratch_arena;
+
+ArenaChunk *new_arena_chunk(int size) {
+	ArenaChunk *chunk = calloc(1, sizeof(ArenaChunk));
+	if (size < ARENA_CHUNK_SIZE) {
+		size = ARENA_CHUNK_SIZE;
+	}
+	chunk->buf = calloc(size, sizeof(char));
+	if (chunk->buf == NULL) {
+		error("out of memory");
+	}
+	chunk->cap = size;
+	return chunk;
+}
+
+Arena *new_arena(void) {
+	Arena *arena = calloc(1, sizeof(Arena));
+	arena->head = new_arena_chunk(ARENA_CHUNK_SIZE);
+	arena->cur = arena->head;
+	return arena;
+}
+
+void initialize_arenas(void) {
+	token_arena = new_arena();
+	ast_arena = new_arena();
+	scratch_arena = new_arena();
+}
+
+// Returns size bytes of zeroed memory, aligned for any object.
+void *arena_alloc(Arena *arena, int size) {
+	size = align_to(size, 8);
+
+	ArenaChunk *chunk = arena->cur;
+	while (chunk->used + size > chunk->cap) {
+		if (chunk->next == NULL) {
+			chunk->next = new_arena_chunk(size);
+		}
+		chunk = chunk->next;
+	}
+	arena->cur = chunk;
+
+	char *p = chunk->buf + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
+// Discards everything allocated from the arena, keeping its chunks.
+void arena_reset(Arena *arena) {
+	ArenaChunk *chunk;
+	for (chunk = arena->head; chunk; chunk = chunk->next) {
+		memset(chunk->buf, 0, chunk->used);
+		chunk->used = 0;
+	}
+	arena->cur = arena->head;
+}